@@ -0,0 +1,266 @@
+#ifndef BENCH61_HH
+#define BENCH61_HH
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// bench61.hh
+//    Micro-benchmark support shared by the problem sets. Psets that use
+//    it add `-I../common` to CPPFLAGS.
+//
+//    Results are reported as one line of JSON per benchmark:
+//
+//    {"time":MEDIAN, "time_mad":MAD, "time_min":MIN, "time_max":MAX,
+//     "trials":N, "warmup":W, "cycles":MEDIAN, "utime":U, "stime":S,
+//     "maxrss":KB, ...extra numbers..., "schema":"bench61",
+//     "bench":NAME, "cycles_source":"perf"|"rdtsc"|"none"}
+//
+//    Times are in seconds. `time` is the median trial, `time_mad` the
+//    median absolute deviation; both resist outlier trials. `utime`,
+//    `stime`, and `maxrss` cover the whole process (and its children), as
+//    in the io61 profiler's output. String fields come last, since the
+//    check.pl parsers only look for `"key":number` pairs.
+
+
+// bench61_now()
+//    Returns the current monotonic time in seconds.
+
+inline double bench61_now() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+// bench61_cycle_counter
+//    Counts CPU cycles. Uses a perf_event_open hardware counter (user
+//    mode, this thread and threads it creates) when the kernel permits,
+//    falling back to the timestamp counter, and otherwise to nothing.
+
+struct bench61_cycle_counter {
+    int fd = -1;
+    const char* source = "none";
+
+    bench61_cycle_counter() {
+#if __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        this->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (this->fd >= 0) {
+            this->source = "perf";
+            return;
+        }
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+        this->source = "rdtsc";
+#endif
+    }
+    ~bench61_cycle_counter() {
+        if (this->fd >= 0) {
+            close(this->fd);
+        }
+    }
+    bench61_cycle_counter(const bench61_cycle_counter&) = delete;
+    bench61_cycle_counter& operator=(const bench61_cycle_counter&) = delete;
+
+    uint64_t read() {
+        uint64_t x = 0;
+        if (this->fd >= 0) {
+            if (::read(this->fd, &x, sizeof(x)) != (ssize_t) sizeof(x)) {
+                x = 0;
+            }
+            return x;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        x = __rdtsc();
+#endif
+        return x;
+    }
+};
+
+
+// bench61_median(xs), bench61_mad(xs)
+//    Return the median and the median absolute deviation of `xs`.
+
+inline double bench61_median(std::vector<double> xs) {
+    if (xs.empty()) {
+        return 0;
+    }
+    std::sort(xs.begin(), xs.end());
+    size_t n = xs.size();
+    return n % 2 ? xs[n / 2] : (xs[n / 2 - 1] + xs[n / 2]) / 2;
+}
+
+inline double bench61_mad(const std::vector<double>& xs) {
+    double m = bench61_median(xs);
+    std::vector<double> dev;
+    for (double x : xs) {
+        dev.push_back(x < m ? m - x : x - m);
+    }
+    return bench61_median(dev);
+}
+
+
+// bench61_output_fd()
+//    Returns the file descriptor for benchmark records: file descriptor
+//    100 if it is open (check.pl's channel), otherwise the file named by
+//    the `BENCH61` environment variable (appended; `-` means standard
+//    error), otherwise -1.
+
+inline int bench61_output_fd() {
+    off_t off = lseek(100, 0, SEEK_CUR);
+    if (off != (off_t) -1 || errno == ESPIPE) {
+        return 100;
+    }
+    const char* fn = getenv("BENCH61");
+    if (!fn || !*fn) {
+        return -1;
+    } else if (strcmp(fn, "-") == 0) {
+        return STDERR_FILENO;
+    }
+    static int fd = -1;
+    if (fd < 0) {
+        fd = open(fn, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    }
+    return fd;
+}
+
+
+// bench61_record
+//    The measurements for one benchmark.
+
+struct bench61_record {
+    std::string name;
+    unsigned warmup = 0;
+    std::vector<double> times;
+    std::vector<double> cycles;
+    const char* cycles_source = "none";
+    std::vector<std::pair<std::string, double>> extra;
+
+    explicit bench61_record(std::string name_)
+        : name(std::move(name_)) {
+    }
+
+    // add(key, value)
+    //    Adds a numeric field, such as an operation count, to the record.
+    bench61_record& add(const char* key, double value) {
+        this->extra.emplace_back(key, value);
+        return *this;
+    }
+
+    std::string json() const;
+
+    // emit(fd)
+    //    Writes the record to `fd` (default `bench61_output_fd()`).
+    //    Does nothing if `fd < 0`.
+    void emit(int fd = bench61_output_fd()) const;
+};
+
+inline std::string bench61_record::json() const {
+    rusage usage, cusage;
+    getrusage(RUSAGE_SELF, &usage);
+    getrusage(RUSAGE_CHILDREN, &cusage);
+    timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
+    timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
+    long maxrss = usage.ru_maxrss + cusage.ru_maxrss;
+#if __MACH__
+    maxrss = (maxrss + 1023) / 1024;
+#endif
+
+    double tmin = 0, tmax = 0;
+    if (!this->times.empty()) {
+        tmin = *std::min_element(this->times.begin(), this->times.end());
+        tmax = *std::max_element(this->times.begin(), this->times.end());
+    }
+
+    char buf[1000];
+    snprintf(buf, sizeof(buf),
+        "{\"time\":%.6f, \"time_mad\":%.6f, \"time_min\":%.6f, \"time_max\":%.6f, "
+        "\"trials\":%zu, \"warmup\":%u, \"cycles\":%.0f, "
+        "\"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld",
+        bench61_median(this->times), bench61_mad(this->times), tmin, tmax,
+        this->times.size(), this->warmup, bench61_median(this->cycles),
+        usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
+        usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
+        maxrss);
+    std::string s = buf;
+    for (auto& kv : this->extra) {
+        snprintf(buf, sizeof(buf), ", \"%s\":%.6g", kv.first.c_str(), kv.second);
+        s += buf;
+    }
+    s += ", \"schema\":\"bench61\", \"bench\":\"" + this->name
+        + "\", \"cycles_source\":\"" + this->cycles_source + "\"}\n";
+    return s;
+}
+
+inline void bench61_record::emit(int fd) const {
+    if (fd < 0) {
+        return;
+    }
+    std::string s = this->json();
+    if (fd == STDERR_FILENO) {
+        fflush(stderr);
+    }
+    size_t pos = 0;
+    while (pos != s.size()) {
+        ssize_t nw = write(fd, s.data() + pos, s.size() - pos);
+        if (nw > 0) {
+            pos += nw;
+        } else if (nw == 0 || (errno != EINTR && errno != EAGAIN)) {
+            break;
+        }
+    }
+}
+
+
+// bench61_run(name, fn, trials, warmup)
+//    Calls `fn()` `warmup` times untimed, then `trials` times timed, and
+//    returns the resulting record.
+
+template <typename F>
+bench61_record bench61_run(const char* name, F&& fn,
+                           unsigned trials = 5, unsigned warmup = 1) {
+    bench61_record rec(name);
+    bench61_cycle_counter cc;
+    rec.warmup = warmup;
+    rec.cycles_source = cc.source;
+    for (unsigned i = 0; i != warmup; ++i) {
+        fn();
+    }
+    for (unsigned i = 0; i != trials; ++i) {
+        uint64_t c0 = cc.read();
+        double t0 = bench61_now();
+        fn();
+        double t1 = bench61_now();
+        uint64_t c1 = cc.read();
+        rec.times.push_back(t1 - t0);
+        rec.cycles.push_back(c1 - c0);
+    }
+    return rec;
+}
+
+#endif
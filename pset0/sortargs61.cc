@@ -1,21 +1,388 @@
 #include <cstdio>
-#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
 using namespace std;
 
-int main(int argc, char* argv[]){
-    int i = 1;
-    while (i < argc) {
-        int j = i;
-        while (j > 0 && strcmp(argv[j-1], argv[j]) > 0) {
-            char* temp = argv[j];
-            argv[j] = argv[j-1];
-            argv[j-1] = temp;
-            j--;
-        }
-        i++;
-    }
-    for (int j = 1; j < argc; j++) {
-        printf("%s\n", argv[j]);
-    };
+// Usage: ./sortargs61 [-m MEGABYTES] [ARG...]
+//    With arguments, prints the ARGs in sorted order, one per line.
+//    Without arguments, sorts the lines of standard input. Input that
+//    does not fit in MEGABYTES of memory (default 64) is sorted in runs
+//    that are spilled to a temporary file and merged, in several passes
+//    if there are too many runs to merge at once within MEGABYTES.
+//    Lines compare like `strcmp`, by unsigned byte values.
+
+// line_view
+//    A line (without its newline) stored elsewhere, usually in the arena.
+
+struct line_view {
+    const unsigned char* p;
+    size_t len;
+};
+
+static inline int compare_lines(const line_view& a, const line_view& b) {
+    size_t n = a.len < b.len ? a.len : b.len;
+    int c = memcmp(a.p, b.p, n);
+    if (c == 0) {
+        c = a.len < b.len ? -1 : (a.len > b.len ? 1 : 0);
+    }
+    return c;
+}
+
+// byte_at(l, depth)
+//    Returns the byte at `depth` in `l` plus 1, or 0 if `l` ends there.
+
+static inline unsigned byte_at(const line_view& l, size_t depth) {
+    return depth < l.len ? l.p[depth] + 1 : 0;
+}
+
+
+// msd_sort(v, tmp, n)
+//    Sorts the `n` lines in `v` using most-significant-digit radix sort.
+//    Small buckets switch to insertion sort. `tmp` is scratch space for
+//    `n` lines. Buckets wait on an explicit stack rather than recursing,
+//    so long shared prefixes cannot overflow the call stack.
+
+struct msd_task {
+    line_view* v;
+    size_t n;
+    size_t depth;   // all `n` lines share their first `depth` bytes
+};
+
+static void insertion_sort(line_view* v, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        line_view x = v[i];
+        size_t j = i;
+        while (j > 0 && compare_lines(v[j - 1], x) > 0) {
+            v[j] = v[j - 1];
+            --j;
+        }
+        v[j] = x;
+    }
+}
+
+static void msd_sort(line_view* v, line_view* tmp, size_t n) {
+    vector<msd_task> stack;
+    stack.push_back({v, n, 0});
+    while (!stack.empty()) {
+        msd_task t = stack.back();
+        stack.pop_back();
+        if (t.n < 32) {
+            insertion_sort(t.v, t.n);
+            continue;
+        }
+        size_t count[258] = {0};
+        for (size_t i = 0; i != t.n; ++i) {
+            ++count[byte_at(t.v[i], t.depth) + 1];
+        }
+        // common case: every line has the same byte here
+        if (count[byte_at(t.v[0], t.depth) + 1] == t.n) {
+            if (byte_at(t.v[0], t.depth) != 0) {
+                stack.push_back({t.v, t.n, t.depth + 1});
+            }   // otherwise all lines are equal
+            continue;
+        }
+        for (int b = 1; b != 258; ++b) {
+            count[b] += count[b - 1];
+        }
+        for (size_t i = 0; i != t.n; ++i) {
+            tmp[count[byte_at(t.v[i], t.depth)]++] = t.v[i];
+        }
+        memcpy(t.v, tmp, t.n * sizeof(line_view));
+        // now `count[b]` is the end of bucket `b`; bucket 0 (lines that
+        // ended) is already sorted
+        for (int b = 1; b != 257; ++b) {
+            size_t lo = count[b - 1], hi = count[b];
+            if (hi - lo > 1) {
+                stack.push_back({t.v + lo, hi - lo, t.depth + 1});
+            }
+        }
+    }
+}
+
+static void sort_lines(vector<line_view>& lines) {
+    vector<line_view> tmp(lines.size());
+    msd_sort(lines.data(), tmp.data(), lines.size());
+}
+
+static void write_lines(FILE* f, const vector<line_view>& lines) {
+    for (auto& l : lines) {
+        fwrite(l.p, 1, l.len, f);
+        fputc('\n', f);
+    }
+}
+
+
+// Sorted runs that don't fit in memory are spilled to one temporary
+// file, one after another; a `run_span` locates each run there. Since
+// the runs share a file descriptor, any number of them can be merged
+// without running out of descriptors.
+
+struct run_span {
+    off_t off;
+    off_t len;
+};
+
+// open_runs()
+//    Returns a new temporary file for sorted runs. Exits on error.
+
+static FILE* open_runs() {
+    FILE* f = tmpfile();
+    if (!f) {
+        perror("sortargs61: tmpfile");
+        exit(1);
+    }
+    return f;
+}
+
+// append_run(f, lines, runs)
+//    Writes `lines` to the end of `f` as a new run and records it in
+//    `runs`.
+
+static void append_run(FILE* f, const vector<line_view>& lines,
+                       vector<run_span>& runs) {
+    off_t off = ftello(f);
+    write_lines(f, lines);
+    runs.push_back({off, ftello(f) - off});
+}
+
+// finish_runs(f)
+//    Flushes the runs written to `f`, exiting on error (such as a full
+//    disk).
+
+static void finish_runs(FILE* f) {
+    if (fflush(f) != 0 || ferror(f)) {
+        perror("sortargs61: temporary file");
+        exit(1);
+    }
+}
+
+
+// run_reader
+//    One sorted run, read back a line at a time through a buffer of its
+//    own. A line longer than the buffer grows it.
+
+struct run_reader {
+    int fd;
+    off_t pos;
+    off_t end;
+    vector<unsigned char> buf;
+    size_t lo = 0;
+    size_t hi = 0;
+    line_view cur;
+
+    bool advance() {
+        while (true) {
+            auto nl = (unsigned char*) memchr(&buf[lo], '\n', hi - lo);
+            if (nl) {
+                cur.p = &buf[lo];
+                cur.len = nl - &buf[lo];
+                lo = nl + 1 - buf.data();
+                return true;
+            } else if (pos == end) {
+                return false;   // runs end with a newline
+            }
+            memmove(buf.data(), &buf[lo], hi - lo);
+            hi -= lo;
+            lo = 0;
+            if (hi == buf.size()) {
+                buf.resize(buf.size() * 2);
+            }
+            size_t want = min((off_t) (buf.size() - hi), end - pos);
+            ssize_t n = pread(fd, &buf[hi], want, pos);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                perror("sortargs61: temporary file");
+                exit(1);
+            }
+            hi += n;
+            pos += n;
+        }
+    }
+};
+
+struct run_greater {
+    bool operator()(const run_reader* a, const run_reader* b) const {
+        return compare_lines(a->cur, b->cur) > 0;
+    }
+};
+
+// merge_runs(fd, runs, n, out, bufsize)
+//    Writes the k-way merge of the `n` sorted runs starting at `runs`,
+//    stored in `fd`, to `out`. Each run is read through a `bufsize`-byte
+//    buffer.
+
+static void merge_runs(int fd, const run_span* runs, size_t n, FILE* out,
+                       size_t bufsize) {
+    vector<run_reader> readers(n);
+    priority_queue<run_reader*, vector<run_reader*>, run_greater> heap;
+    for (size_t i = 0; i != n; ++i) {
+        readers[i].fd = fd;
+        readers[i].pos = runs[i].off;
+        readers[i].end = runs[i].off + runs[i].len;
+        readers[i].buf.resize(bufsize);
+        if (readers[i].advance()) {
+            heap.push(&readers[i]);
+        }
+    }
+    while (!heap.empty()) {
+        run_reader* r = heap.top();
+        heap.pop();
+        fwrite(r->cur.p, 1, r->cur.len, out);
+        fputc('\n', out);
+        if (r->advance()) {
+            heap.push(r);
+        }
+    }
+}
+
+// merge_all(f, runs, budget)
+//    Writes the merge of the sorted `runs` stored in `f` to standard
+//    output, using about `budget` bytes of buffers. The fan-in is
+//    bounded by the budget (every input, and the output, gets at least
+//    64 KiB); while there are more runs than that, passes merge groups
+//    of them into a new temporary file. Closes `f`.
+
+static void merge_all(FILE* f, vector<run_span> runs, size_t budget) {
+    constexpr size_t minbuf = 64 << 10;
+    size_t fanin = max(budget / minbuf, (size_t) 3) - 1;
+    while (runs.size() > fanin) {
+        size_t bufsize = min(budget / (fanin + 1), (size_t) 1 << 20);
+        FILE* next = open_runs();
+        setvbuf(next, nullptr, _IOFBF, bufsize);
+        vector<run_span> merged;
+        for (size_t i = 0; i < runs.size(); i += fanin) {
+            off_t off = ftello(next);
+            merge_runs(fileno(f), &runs[i], min(fanin, runs.size() - i),
+                       next, bufsize);
+            merged.push_back({off, ftello(next) - off});
+        }
+        finish_runs(next);
+        fclose(f);
+        f = next;
+        runs.swap(merged);
+    }
+    size_t bufsize = min(budget / (runs.size() + 1), (size_t) 1 << 20);
+    setvbuf(stdout, nullptr, _IOFBF, bufsize);
+    merge_runs(fileno(f), runs.data(), runs.size(), stdout, bufsize);
+    fclose(f);
+}
+
+
+// sort_stdin(budget)
+//    Sorts standard input's lines to standard output using about `budget`
+//    bytes of memory for line data and line views.
+
+static void sort_stdin(size_t budget) {
+    size_t cap = budget > (2 << 20) ? budget : (2 << 20);
+    unsigned char* arena = (unsigned char*) malloc(cap);
+    size_t len = 0;         // bytes of data in `arena`
+    size_t scanned = 0;     // bytes of `arena` already split into lines
+    size_t line_start = 0;  // start of current partial line
+    vector<line_view> lines;
+    FILE* runf = nullptr;   // spilled runs, if any
+    vector<run_span> runs;
+    bool eof = false;
+
+    while (!eof) {
+        // line views count against the budget too
+        bool full = len == cap
+            || lines.size() * sizeof(line_view) + len >= budget;
+        if (full && line_start != 0) {
+            // spill a sorted run, keep the partial line
+            sort_lines(lines);
+            if (!runf) {
+                runf = open_runs();
+            }
+            append_run(runf, lines, runs);
+            lines.clear();
+            memmove(arena, arena + line_start, len - line_start);
+            len -= line_start;
+            scanned -= line_start;
+            line_start = 0;
+        } else if (len == cap) {
+            // one line fills the arena: grow it
+            cap *= 2;
+            arena = (unsigned char*) realloc(arena, cap);
+        }
+
+        // read a large block
+        size_t want = cap - len < (1 << 20) ? cap - len : (1 << 20);
+        ssize_t n = read(STDIN_FILENO, arena + len, want);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // nonblocking input: wait for more rather than spinning
+            struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+                perror("sortargs61");
+                exit(1);
+            }
+            continue;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            perror("sortargs61");
+            exit(1);
+        } else if (n == 0) {
+            eof = true;
+        }
+        len += n;
+
+        // split complete lines
+        unsigned char* nl;
+        while ((nl = (unsigned char*) memchr(arena + scanned, '\n', len - scanned))) {
+            lines.push_back({arena + line_start,
+                             (size_t) (nl - (arena + line_start))});
+            scanned = line_start = nl + 1 - arena;
+        }
+        scanned = len;
+        if (eof && line_start != len) {
+            lines.push_back({arena + line_start, len - line_start});
+            line_start = len;
+        }
+    }
+
+    sort_lines(lines);
+    if (!runf) {
+        setvbuf(stdout, nullptr, _IOFBF, 1 << 20);
+        write_lines(stdout, lines);
+        free(arena);
+        return;
+    }
+    append_run(runf, lines, runs);
+    finish_runs(runf);
+    lines = vector<line_view>();
+    free(arena);
+    merge_all(runf, runs, budget);
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t budget = 64 << 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        if (opt == 'm' && strtoul(optarg, nullptr, 0) > 0) {
+            budget = strtoul(optarg, nullptr, 0) << 20;
+        } else {
+            fprintf(stderr, "Usage: %s [-m MEGABYTES] [ARG...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind < argc) {
+        vector<line_view> args;
+        for (int i = optind; i < argc; ++i) {
+            args.push_back({(const unsigned char*) argv[i], strlen(argv[i])});
+        }
+        sort_lines(args);
+        write_lines(stdout, args);
+    } else {
+        sort_stdin(budget);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,28 +1,224 @@
 #include <cstdio>
-#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-int main() {
-    unsigned long spaces = 0;
+// Usage: ./wc61 [-j N] [FILE]
+//    Counts lines, words, and bytes in FILE (default standard input).
+//    A word is a maximal run of non-space characters, where space means
+//    `isspace` in the C locale (' ', '\t', '\n', '\v', '\f', '\r').
+//    With `-j N`, a regular FILE is split into N ranges that are
+//    counted in parallel.
+
+struct wc_counts {
     unsigned long lines = 0;
+    unsigned long words = 0;
     unsigned long bytes = 0;
+    bool in_space = true;       // was the last byte counted a space?
+};
+
+static inline bool is_space(unsigned char ch) {
+    return ch == ' ' || (unsigned char) (ch - '\t') <= '\r' - '\t';
+}
+
+
+// count_block(c, p, n)
+//    Adds the lines, words, and bytes in `p[0..n)` to `c`. A word that
+//    begins in `p` is counted only if it does not continue a word from
+//    the previous block, as recorded in `c.in_space`.
+
+static void count_block(wc_counts& c, const unsigned char* p, size_t n) {
+    c.bytes += n;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 64 bytes at a time: build 64-bit masks of spaces and newlines, then
+    // a word starts at each non-space whose predecessor is a space.
+    const __m128i vnl = _mm_set1_epi8('\n');
+    const __m128i vsp = _mm_set1_epi8(' ');
+    const __m128i vtab = _mm_set1_epi8('\t');
+    const __m128i vrange = _mm_set1_epi8('\r' - '\t');
+    uint64_t carry = c.in_space;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t space = 0, nl = 0;
+        for (int k = 0; k != 4; ++k) {
+            __m128i v = _mm_loadu_si128((const __m128i*) &p[i + 16 * k]);
+            __m128i t = _mm_sub_epi8(v, vtab);
+            // `t <= '\r' - '\t'` as unsigned bytes
+            __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, vrange), t);
+            __m128i sp = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, vsp));
+            space |= (uint64_t) (uint16_t) _mm_movemask_epi8(sp) << (16 * k);
+            nl |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, vnl)) << (16 * k);
+        }
+        uint64_t starts = ~space & ((space << 1) | carry);
+        c.words += __builtin_popcountll(starts);
+        c.lines += __builtin_popcountll(nl);
+        carry = space >> 63;
+    }
+    c.in_space = carry;
+#endif
+    for (; i != n; ++i) {
+        bool space = is_space(p[i]);
+        c.words += !space && c.in_space;
+        c.in_space = space;
+        c.lines += p[i] == '\n';
+    }
+}
+
 
+static constexpr size_t blocksize = 1 << 20;
 
-    bool in_space = true;
+// count_fd(c, fd)
+//    Counts `fd` from its current position to end of file using large
+//    `read` calls. A nonblocking `fd` is waited on with `poll` rather
+//    than retried in a busy loop.
 
+static int count_fd(wc_counts& c, int fd) {
+    unsigned char* buf = (unsigned char*) aligned_alloc(64, blocksize);
     while (true) {
-        int chr = fgetc(stdin);
-        if (chr == (EOF)) {
+        ssize_t n = read(fd, buf, blocksize);
+        if (n == 0) {
             break;
+        } else if (n > 0) {
+            count_block(c, buf, n);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+                free(buf);
+                return -1;
+            }
+        } else if (errno != EINTR) {
+            free(buf);
+            return -1;
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+
+// wc_range
+//    One range of a parallel count. Besides the counts, remembers whether
+//    the range starts with a non-space, so neighboring ranges can be merged.
+
+struct wc_range {
+    off_t off;
+    off_t len;
+    wc_counts c;
+    bool starts_word = false;
+    int err = 0;
+};
+
+static void count_range(int fd, wc_range* r) {
+    unsigned char* buf = (unsigned char*) aligned_alloc(64, blocksize);
+    off_t pos = r->off, end = r->off + r->len;
+    while (pos < end) {
+        size_t want = end - pos < (off_t) blocksize ? end - pos : blocksize;
+        ssize_t n = pread(fd, buf, want, pos);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            r->err = n < 0 ? errno : EIO;
+            break;
+        }
+        if (pos == r->off) {
+            r->starts_word = !is_space(buf[0]);
         }
-        bool space = isspace(chr);
-        if (!space && (in_space)) {
-            spaces++;
+        count_block(r->c, buf, n);
+        pos += n;
+    }
+    free(buf);
+}
+
+// count_parallel(c, fd, begin, end, nthreads)
+//    Counts bytes `[begin, end)` of a regular file with `nthreads`
+//    threads. Each thread counts its range as if it followed a space; then
+//    a range that starts mid-word (previous range ended in a non-space,
+//    this one starts with a non-space) gives back the word it over-counted.
+
+static int count_parallel(wc_counts& c, int fd, off_t begin, off_t end,
+                          unsigned nthreads) {
+    std::vector<wc_range> ranges(nthreads);
+    off_t chunk = (end - begin + nthreads - 1) / nthreads;
+    chunk = (chunk + 4095) & ~(off_t) 4095;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t != nthreads; ++t) {
+        off_t off = begin + chunk * t < end ? begin + chunk * t : end;
+        ranges[t].off = off;
+        ranges[t].len = off + chunk < end ? chunk : end - off;
+        threads.emplace_back(count_range, fd, &ranges[t]);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (auto& r : ranges) {
+        if (r.err) {
+            errno = r.err;
+            return -1;
         }
-        in_space = space;
-        if (chr == '\n') {
-            lines++;
+        if (r.len == 0) {
+            continue;
         }
-        ++bytes;
+        c.lines += r.c.lines;
+        c.words += r.c.words;
+        if (r.starts_word && !c.in_space) {
+            --c.words;
+        }
+        c.bytes += r.c.bytes;
+        c.in_space = r.c.in_space;
     }
-    fprintf(stdout, "Lines: %lu\nWords: %lu\nBytes: %lu\n", lines, spaces, bytes);
-}
\ No newline at end of file
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    unsigned nthreads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt == 'j' && atoi(optarg) > 0) {
+            nthreads = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-j N] [FILE]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    int fd = STDIN_FILENO;
+    if (optind < argc) {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+            exit(1);
+        }
+    }
+
+    wc_counts c;
+    struct stat st;
+    int r;
+    if (nthreads > 1
+        && fstat(fd, &st) == 0
+        && S_ISREG(st.st_mode)
+        && st.st_size >= (off_t) (nthreads * blocksize)) {
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        r = count_parallel(c, fd, pos, st.st_size, nthreads);
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        r = count_fd(c, fd);
+    }
+    if (r < 0) {
+        fprintf(stderr, "wc61: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    fprintf(stdout, "Lines: %lu\nWords: %lu\nBytes: %lu\n", c.lines, c.words, c.bytes);
+}
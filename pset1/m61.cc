@@ -142,20 +142,24 @@ static void new_malloc(void* ptr, size_t sz, const char* file, int line) {
     size_t space_im_taking = sz + SIZECONST;
     space_im_taking += add_padding(space_im_taking);
 
-    // Checking if the malloc is on the original buffer
-    // If so we may need to break it up into smaller pieces
-    auto it = freed_allocations.find((size_t) ptr);
-    if (it != freed_allocations.end()) {
-        size_t spare_space = it->second - space_im_taking;
-        assert(spare_space % alignof(max_align_t) == 0);
-        if (spare_space > 0) {
-            auto temp1 = it->first;
-            freed_allocations.erase(it);
-            assert(temp1 % 16 == 0);
-            freed_allocations.insert({temp1 + space_im_taking, spare_space});
-        }
-        else {
+    // Checking if the malloc is inside a free region (the original buffer
+    // is one big free region). If so, split the region around it; the
+    // region may have been coalesced to start below `ptr`.
+    auto it = freed_allocations.upper_bound((size_t) ptr);
+    if (it != freed_allocations.begin()) {
+        --it;
+        size_t start = it->first;
+        size_t end = it->first + it->second;
+        if (end > (size_t) ptr) {
             freed_allocations.erase(it);
+            if (start < (size_t) ptr) {
+                freed_allocations.insert({start, (size_t) ptr - start});
+            }
+            size_t alloc_end = (size_t) ptr + space_im_taking;
+            assert(alloc_end <= end && alloc_end % alignof(max_align_t) == 0);
+            if (alloc_end < end) {
+                freed_allocations.insert({alloc_end, end - alloc_end});
+            }
         }
     }
 
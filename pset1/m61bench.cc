@@ -0,0 +1,120 @@
+#include "m61.hh"
+#include "bench61.hh"
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <unistd.h>
+
+// Usage: ./m61bench [-t TRIALS] [-w WARMUP] [WORKLOAD...]
+//    Times m61 allocation workloads and prints one bench61 JSON record
+//    per workload (to file descriptor 100 or $BENCH61 if available,
+//    otherwise to standard output). Workloads are `churn`, `sizes`,
+//    `calloc`, and `batch`; the default is all of them.
+
+
+// churn: 100000 20-byte allocations, at most 100 active (like test27)
+static void churn() {
+    std::default_random_engine randomness(61);
+    std::deque<void*> ptrs;
+    for (int i = 0; i != 100000; ++i) {
+        if (ptrs.size() >= 100
+            || (ptrs.size() > 0 && uniform_int(0, 2, randomness) == 0)) {
+            m61_free(ptrs.front());
+            ptrs.pop_front();
+        } else {
+            void* ptr = m61_malloc(20);
+            assert(ptr);
+            ptrs.push_back(ptr);
+        }
+    }
+    while (!ptrs.empty()) {
+        m61_free(ptrs.front());
+        ptrs.pop_front();
+    }
+}
+
+// sizes: 1-2000-byte allocations in 5 slots, freed in random order
+static void sizes() {
+    std::default_random_engine randomness(61);
+    void* ptrs[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+    for (int round = 0; round != 100000; ++round) {
+        int index = uniform_int(0, 4, randomness);
+        if (!ptrs[index]) {
+            ptrs[index] = m61_malloc(uniform_int(1, 2000, randomness));
+            assert(ptrs[index]);
+        } else {
+            m61_free(ptrs[index]);
+            ptrs[index] = nullptr;
+        }
+    }
+    for (int i = 0; i != 5; ++i) {
+        m61_free(ptrs[i]);
+    }
+}
+
+// calloc: zeroed 1-2000-byte allocations, touched and freed
+static void calloc_() {
+    std::default_random_engine randomness(61);
+    for (int round = 0; round != 20000; ++round) {
+        size_t sz = uniform_int(1, 2000, randomness);
+        char* p = (char*) m61_calloc(sz, 1);
+        assert(p && p[sz - 1] == 0);
+        memset(p, 'A', sz);
+        m61_free(p);
+    }
+}
+
+// batch: allocate 2000 blocks, then free them all
+static void batch() {
+    std::default_random_engine randomness(61);
+    static void* ptrs[2000];
+    for (int i = 0; i != 2000; ++i) {
+        ptrs[i] = m61_malloc(uniform_int(1, 1000, randomness));
+        assert(ptrs[i]);
+    }
+    for (int i = 0; i != 2000; ++i) {
+        m61_free(ptrs[i]);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    unsigned trials = 5, warmup = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:")) != -1) {
+        if (opt == 't') {
+            trials = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'w') {
+            warmup = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: %s [-t TRIALS] [-w WARMUP] [WORKLOAD...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    struct workload {
+        const char* name;
+        void (*fn)();
+    } workloads[] = {
+        {"churn", churn}, {"sizes", sizes}, {"calloc", calloc_}, {"batch", batch}
+    };
+
+    int fd = bench61_output_fd();
+    if (fd < 0) {
+        fd = STDOUT_FILENO;
+    }
+    for (auto& w : workloads) {
+        bool selected = optind == argc;
+        for (int i = optind; i < argc; ++i) {
+            selected = selected || strcmp(argv[i], w.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        unsigned long long before = m61_get_statistics().ntotal;
+        bench61_record rec = bench61_run(w.name, w.fn, trials, warmup);
+        unsigned long long nallocs = m61_get_statistics().ntotal - before;
+        rec.add("allocations", trials + warmup ? nallocs / (trials + warmup) : 0);
+        rec.emit(fd);
+    }
+}
@@ -0,0 +1,29 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that a free region coalesced below the next allocation is split.
+
+int main() {
+    char* a = (char*) m61_malloc(100);
+    m61_free(a);
+    char* b = (char*) m61_malloc(100);
+    memset(b, 'b', 100);
+    // `b` came from the free region that now starts at `a`, so that
+    // region no longer has room for this allocation.
+    size_t big_size = (8 << 20) - 200;
+    char* c = (char*) m61_malloc(big_size);
+    if (c) {
+        assert(c + big_size <= b || c >= b + 100);
+        memset(c, 'c', big_size);
+    }
+    for (int i = 0; i != 100; ++i) {
+        assert(b[i] == 'b');
+    }
+    m61_free(b);
+    m61_free(c);
+    m61_print_statistics();
+}
+
+//! alloc count: active          0   total          2   fail          1
+//! alloc size:  active        ???   total        200   fail    8388408
@@ -1,12 +1,13 @@
 #include "io61.hh"
 
-// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [-c] [FILE]
 //    Copies the input FILE to standard output in blocks.
-//    Default BLOCKSIZE is 4096.
+//    Default BLOCKSIZE is 4096. With `-c`, copies each block with
+//    io61_copy instead of io61_read and io61_write.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("b:o:i:D:Fy", 4096).parse(argc, argv);
+    io61_args args = io61_args("b:o:i:D:Fyc", 4096).parse(argc, argv);
 
     // Allocate buffer, open files
     unsigned char* buf = new unsigned char[args.block_size];
@@ -17,7 +18,16 @@ int main(int argc, char* argv[]) {
     args.after_open(outf, O_WRONLY);
 
     // Copy file data
-    while (true) {
+    while (args.copy) {
+        ssize_t n = io61_copy(inf, outf, args.block_size);
+        if (n <= 0) {
+            break;
+        }
+
+        args.after_write(outf);
+    }
+
+    while (!args.copy) {
         ssize_t nr = io61_read(inf, buf, args.block_size);
         if (nr <= 0) {
             break;
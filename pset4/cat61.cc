@@ -1,18 +1,29 @@
 #include "io61.hh"
 
-// Usage: ./cat61 [-s SIZE] [-o OUTFILE] [FILE]
+// Usage: ./cat61 [-s SIZE] [-o OUTFILE] [-c] [FILE]
 //    Copies the input FILE to OUTFILE one character at a time.
+//    With `-c`, copies with io61_copy instead.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("s:o:i:D:a:Fy").parse(argc, argv);
+    io61_args args = io61_args("s:o:i:D:a:Fyc").parse(argc, argv);
 
     io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
     io61_file* outf = io61_open_check(args.output_file,
                                       O_WRONLY | O_CREAT | O_TRUNC);
     args.after_open();
 
-    while (args.file_size != 0) {
+    while (args.copy && args.file_size != 0) {
+        ssize_t n = io61_copy(inf, outf, args.file_size);
+        if (n <= 0) {
+            break;
+        }
+        args.file_size -= n;
+
+        args.after_write(outf);
+    }
+
+    while (!args.copy && args.file_size != 0) {
         int ch = io61_readc(inf);
         if (ch == EOF) {
             break;
@@ -9,6 +9,19 @@
 #
 #    To add tests of your own, scroll down to the bottom. It should
 #    be relatively clear what to do.
+#
+#    `BENCH=1` selects benchmark mode, which runs the BENCH tests (or
+#    the tests named) for TRIALS trials each, and appends the median
+#    and MAD of each test's time, utime, stime, and maxrss to a CSV file
+#    (`BENCHCSV`, default `bench.csv`) keyed by commit. It then fails if
+#    any test's median time is more than `REGRESS` percent (default 10)
+#    slower than in the baseline: commit `BASELINE`, or by default the
+#    most recent other commit in the CSV.
+#
+#    `FAULTS=SPEC` selects fault mode, which runs every program with
+#    `IO61_FAULTS=SPEC`, so io61 sees simulated short reads, signals,
+#    and delays (see io61_faults in io61.cc). Outputs must still match.
+#    `make check-faults` uses a standard SPEC.
 
 use Time::HiRes qw(gettimeofday);
 use Fcntl qw(F_GETFL F_SETFL O_NONBLOCK);
@@ -269,9 +282,19 @@ sub run_sh61 ($;%) {
         return $answer;
     }
 
-    $nb = POSIX::read(fileno(PR), $buf, 2000);
+    fcntl(PR, F_SETFL, fcntl(PR, F_GETFL, 0) | O_NONBLOCK);
+    $buf = run_sh61_pipe("", fileno(PR));
     close(PR);
-    $buf = $nb > 0 ? substr($buf, 0, $nb) : "";
+
+    # io61 statistics (io61_report): sum the totals of every process
+    while ($buf =~ m,^(.*\"schema\"\s*:\s*\"io61_stats\".*)\n?,mg) {
+        my($line) = $1;
+        next if $line !~ m,\"file\"\s*:\s*\"total\",;
+        while ($line =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+            $answer->{"io61_$1"} += $2;
+        }
+    }
+    $buf =~ s,^.*\"schema\"\s*:\s*\"io61_stats\".*\n?,,mg;
 
     while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
         $answer->{$1} = $2;
@@ -817,6 +840,15 @@ sub run ($) {
             push @ratios, $ratio;
             push @basetimes, $stdiot->{"time"};
         }
+        if ($tt
+            && !exists($tt->{"killed"})
+            && $tt->{"io61_syscalls"}) {
+            my ($lookups) = $tt->{"io61_hits"} + $tt->{"io61_misses"};
+            printf("SYSCALLS:  %d (%.1f KiB per call, %s cache hits)\n",
+                   $tt->{"io61_syscalls"},
+                   $tt->{"io61_bytes"} / $tt->{"io61_syscalls"} / 1024.0,
+                   $lookups ? sprintf("%.1f%%", 100.0 * $tt->{"io61_hits"} / $lookups) : "no");
+        }
         if ($tt && !exists($tt->{"killed"})) {
             if (!exists($tt->{"different_size"}) && !exists($tt->{"different_content"})) {
                 if (!$qitem->{"perf"}) {
@@ -900,13 +932,114 @@ sub summary () {
     }
 }
 
+sub median (@) {
+    my (@x) = sort { $a <=> $b } @_;
+    return 0 if !@x;
+    return @x % 2 ? $x[$#x / 2] : ($x[@x / 2 - 1] + $x[@x / 2]) / 2;
+}
+
+sub mad (@) {
+    my ($m) = median(@_);
+    return median(map { abs($_ - $m) } @_);
+}
+
+my (@BENCH_COLUMNS) = ("commit", "date", "test", "type", "trials",
+                       map { ($_, $_ . "_mad") } ("time", "utime", "stime", "maxrss"));
+
+sub bench_report () {
+    # summarize this run's trials
+    my ($commit) = `git describe --always --dirty 2>/dev/null`;
+    chomp($commit);
+    $commit = "unknown" if !$commit;
+    my ($date) = POSIX::strftime("%Y-%m-%dT%H:%M:%S", localtime());
+    my (%trials, @rows);
+    foreach my $t (@alltests) {
+        next if exists($t->{"killed"}) || !exists($t->{"id"});
+        push @{$trials{$t->{"id"} . "," . $t->{"type"}}}, $t;
+    }
+    foreach my $key (sort keys %trials) {
+        my ($ts) = $trials{$key};
+        my ($id, $type) = split(/,/, $key);
+        my ($row) = {"commit" => $commit, "date" => $date, "test" => $id,
+                     "type" => $type, "trials" => scalar(@$ts)};
+        foreach my $f ("time", "utime", "stime", "maxrss") {
+            my (@x) = map { $_->{$f} } grep { defined($_->{$f}) } @$ts;
+            $row->{$f} = sprintf("%.6g", median(@x));
+            $row->{$f . "_mad"} = sprintf("%.6g", mad(@x));
+        }
+        push @rows, $row;
+    }
+
+    # read the history, replacing any earlier results for this commit
+    my ($csv) = $param{"BENCHCSV"};
+    my (@history);
+    if (open(BENCHCSV, "<", $csv)) {
+        my ($header) = scalar(<BENCHCSV>);
+        my (@cols) = defined($header) ? split(/,/, $header =~ s/\s+\z//r) : ();
+        while (defined(my $line = <BENCHCSV>)) {
+            $line =~ s/\s+\z//;
+            my (%r);
+            @r{@cols} = split(/,/, $line);
+            push @history, \%r if $r{"commit"};
+        }
+        close(BENCHCSV);
+    }
+    my (%ran) = map { ($_->{"test"} . "," . $_->{"type"} => 1) } @rows;
+    @history = grep {
+        $_->{"commit"} ne $commit || !$ran{$_->{"test"} . "," . $_->{"type"}}
+    } @history;
+
+    # find the baseline
+    my ($baseline) = $param{"BASELINE"};
+    if (!defined($baseline)) {
+        foreach my $r (@history) {
+            $baseline = $r->{"commit"} if $r->{"commit"} ne $commit;
+        }
+    }
+    my (%base) = map {
+        ($_->{"test"} . "," . $_->{"type"} => $_)
+    } grep { defined($baseline) && $_->{"commit"} eq $baseline } @history;
+
+    push @history, @rows;
+    open(BENCHCSV, ">", $csv) or die "$csv: $!\n";
+    print BENCHCSV join(",", @BENCH_COLUMNS), "\n";
+    foreach my $r (@history) {
+        print BENCHCSV join(",", map { defined($r->{$_}) ? $r->{$_} : "" } @BENCH_COLUMNS), "\n";
+    }
+    close(BENCHCSV);
+
+    # compare your code with the baseline
+    my ($nregress) = 0;
+    print "\nBENCHMARK: ", pl(scalar(@rows), "result"), " for $commit saved in $csv\n";
+    foreach my $r (grep { $_->{"type"} eq "yourcode" } @rows) {
+        my ($b) = $base{$r->{"test"} . ",yourcode"};
+        printf("%-10s %.5fs ±%.5fs", $r->{"test"}, $r->{"time"}, $r->{"time_mad"});
+        if ($b && $b->{"time"} > 0) {
+            my ($change) = 100 * ($r->{"time"} / $b->{"time"} - 1);
+            my ($color) = $change > $param{"REGRESS"} ? $Red : ($change < 0 ? $Green : "");
+            printf(" (${color}%+.1f%%${Off} vs. %.5fs at %s)", $change, $b->{"time"}, $baseline);
+            if ($change > $param{"REGRESS"}) {
+                print " ${Red}REGRESSION${Off}";
+                ++$nregress;
+            }
+        }
+        print "\n";
+    }
+    if (!%base) {
+        print "           no baseline to compare with\n";
+    } elsif ($nregress) {
+        print "           ${Red}", pl($nregress, "test"), " regressed by more than $param{REGRESS}%${Off}\n";
+    }
+    return $nregress;
+}
+
 # read arguments and environment variables
 %param = (
     "NOSTDIO" => boolenv("NOSTDIO"),
     "NOYOURCODE" => boolenv("NOYOURCODE"),
     "NOCOMMAND" => boolenv("NOCOMMAND"),
     "ALLCOMMAND" => boolenv("ALLCOMMAND"),
-    "TRIALTIME" => nonemptyenv("TRIALTIME") ? $ENV{"TRIALTIME"} + 0 : 3,
+    "TRIALTIME" => nonemptyenv("TRIALTIME") ? $ENV{"TRIALTIME"} + 0 : undef,
     "STDIOTRIALTIME" => nonemptyenv("STDIOTRIALTIME") ? $ENV{"STDIOTRIALTIME"} + 0 : undef,
     "TRIALS" => nonemptyenv("TRIALS") ? int($ENV{"TRIALS"}) : 5,
     "STDIOTRIALS" => nonemptyenv("STDIOTRIALS") ? int($ENV{"STDIOTRIALS"}) : undef,
@@ -915,6 +1048,11 @@ sub summary () {
     "NOMAKE" => boolenv("NOMAKE"),
     "STRACE" => boolenv("STRACE"),
     "TMP" => nonemptyenv("TMP") ? boolenv("TMP") : undef,
+    "BENCH" => boolenv("BENCH"),
+    "BENCHCSV" => nonemptyenv("BENCHCSV") ? $ENV{"BENCHCSV"} : "bench.csv",
+    "BASELINE" => nonemptyenv("BASELINE") ? $ENV{"BASELINE"} : undef,
+    "REGRESS" => nonemptyenv("REGRESS") ? $ENV{"REGRESS"} + 0 : 10,
+    "FAULTS" => nonemptyenv("FAULTS") ? $ENV{"FAULTS"} : undef,
     "SEQTEST" => 1
 );
 
@@ -936,6 +1074,9 @@ while (@ARGV) {
 }
 
 $param{"TRIALS"} = 5 if $param{"TRIALS"} <= 0;
+# benchmark mode runs every trial, however long they take
+$param{"TRIALTIME"} = $param{"BENCH"} ? 0 : 3 if !defined($param{"TRIALTIME"});
+push @ALLOW_TESTS, split_testmatch("BENCH") if $param{"BENCH"} && !@ALLOW_TESTS;
 $param{"STDIOTRIALS"} = $param{"TRIALS"} if !defined($param{"STDIOTRIALS"});
 $param{"STDIOTRIALS"} = 5 if $param{"STDIOTRIALS"} <= 0;
 $param{"STDIOTRIALTIME"} = $param{"TRIALTIME"} if !defined($param{"STDIOTRIALTIME"});
@@ -943,6 +1084,7 @@ $param{"MAXTIME"} = 20 if $param{"MAXTIME"} <= 0;
 $param{"NOSTDIO"} = 1 if $param{"STRACE"};
 $param{"DOCKER"} = -e "/usr/bin/cs61-docker-version" ? 1 : 0 if !defined($param{"DOCKER"});
 $param{"TMP"} = $param{"DOCKER"} if !defined($param{"TMP"});
+$ENV{"IO61_FAULTS"} = $param{"FAULTS"} if $param{"FAULTS"};
 
 # maybe read a trial log
 if (defined($param{"TRIALLOG"})) {
@@ -1022,6 +1164,7 @@ my ($revtextsm) = register_file("files/text90k-rev.txt", 3 << 9);
 my ($binsm) = register_file("files/binary3m.bin", 4 << 9);
 my ($textmd) = register_file("files/text10m.txt", 5 << 9);
 my ($textlg) = register_file("files/text64m.txt", 6 << 9);
+my ($revtextmd) = register_file("files/text10m-rev.txt", 7 << 9);
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -1142,6 +1285,16 @@ enqueue("C22",
     "unmappable file, byte I/O, reverse order",
     "perf" => 0, "no_content_check" => 1, "insize" => 4096);
 
+enqueue("C23",
+    "./extendcat61 -b 1000 -p 5000 -o files/out1.txt $textsm > files/out2.txt",
+    "read/write file, writes past end of file then reads them back",
+    "perf" => 0);
+
+enqueue("C24",
+    "./followcat61 -b 1000 -p 300 -o files/rw.txt $textsm | tr -d '\\000' > files/out.txt",
+    "shared file, reads follow other files' writes past end of file",
+    "perf" => 0, "expect" => $textsm);
+
 
 # REGULAR FILES, SEQUENTIAL I/O
 enqueue("MSEQ1",
@@ -1246,6 +1399,36 @@ enqueue("LNONSEQ3",
     "regular large file, 4KB block I/O, random seek order");
 
 
+# BENCHMARKS (BENCH=1 only)
+
+if ($param{"BENCH"}) {
+    enqueue("BENCH1",
+        "./cat61 -o files/out.txt $textmd",
+        "benchmark: regular medium file, byte I/O, sequential");
+
+    enqueue("BENCH2",
+        "./blockcat61 -b 1024 -o files/out.txt $textmd",
+        "benchmark: regular medium file, 1KB block I/O, sequential");
+
+    enqueue("BENCH3",
+        "./reverse61 -o files/out.txt $textmd",
+        "benchmark: regular medium file, byte I/O, reverse order");
+
+    enqueue("BENCH4",
+        "./stridecat61 -t 1048576 -o files/out.txt $textmd",
+        "benchmark: regular medium file, byte I/O, 1MB stride order");
+
+    enqueue("BENCH5",
+        "./reordercat61 -o files/out.txt $textmd",
+        "benchmark: regular medium file, 4KB block I/O, random seek order");
+
+    enqueue("BENCH6",
+        "./scattergather61 -b 512 -o files/out1.txt -o files/out2.txt -i $textmd -i $revtextmd",
+        "benchmark: scatter/gather 2/2 medium files, 512B block I/O");
+}
+
+
 run($param{"SEQTEST"});
 
 summary();
+exit(1) if $param{"BENCH"} && bench_report() > 0;
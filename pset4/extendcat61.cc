@@ -0,0 +1,65 @@
+#include "io61.hh"
+
+// Usage: ./extendcat61 [-b BLOCKSIZE] [-p GAP] [-s SIZE] -o OUTFILE [FILE]
+//    Appends the input FILE to OUTFILE in blocks, leaving a GAP-byte hole
+//    before each block, and copies OUTFILE to standard output as it
+//    grows: after each block, seeks back to where the copy stopped and
+//    reads to end of file. So the output is FILE with GAP zero bytes
+//    before each block. Default BLOCKSIZE is 1024 and default GAP is 0.
+//    OUTFILE is one io61 file opened for reading and writing; reads FILE
+//    using stdio.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:p:s:o:i:", 1024).parse(argc, argv);
+    if (!args.output_file) {
+        args.usage();
+    }
+
+    // Allocate buffers, open files
+    unsigned char* buf = new unsigned char[args.block_size];
+    unsigned char* cbuf = new unsigned char[args.block_size];
+    FILE* inf = stdio_open_check(args.input_file, O_RDONLY);
+    io61_file* f = io61_open_check(args.output_file,
+                                   O_RDWR | O_CREAT | O_TRUNC);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+
+    off_t end = 0, copied = 0;
+    while (args.file_size > 0) {
+        size_t n = fread(buf, 1, std::min(args.block_size, args.file_size),
+                         inf);
+        if (n == 0) {
+            break;
+        }
+        args.file_size -= n;
+
+        // Write the block past end of file
+        end += args.initial_offset;
+        int r = io61_seek(f, end);
+        assert(r == 0);
+        ssize_t nw = io61_write(f, buf, n);
+        assert(nw == (ssize_t) n);
+        end += n;
+
+        // Copy the new data, which starts at the old end of file
+        r = io61_seek(f, copied);
+        assert(r == 0);
+        while (true) {
+            ssize_t nr = io61_read(f, cbuf, args.block_size);
+            assert(nr >= 0);
+            if (nr == 0) {
+                break;
+            }
+            nw = io61_write(outf, cbuf, nr);
+            assert(nw == nr);
+            copied += nr;
+        }
+        args.after_write(outf);
+    }
+
+    fclose(inf);
+    io61_close(f);
+    io61_close(outf);
+    delete[] buf;
+    delete[] cbuf;
+}
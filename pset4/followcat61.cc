@@ -0,0 +1,67 @@
+#include "io61.hh"
+
+// Usage: ./followcat61 [-b BLOCKSIZE] [-p GAP] [-s SIZE] -o OUTFILE [FILE]
+//    Appends the input FILE to OUTFILE in blocks, leaving a GAP-byte hole
+//    before each block, while following OUTFILE to standard output:
+//    after each block, reads OUTFILE on to end of file. As with
+//    `extendcat61`, the output is FILE with GAP zero bytes before each
+//    block. Default BLOCKSIZE is 1024 and default GAP is 0.
+//    OUTFILE is opened three times, as io61 files on one inode: the
+//    blocks alternate between a write-only and a read/write file, and a
+//    read-only file follows them. Reads FILE using stdio.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:p:s:o:i:", 1024).parse(argc, argv);
+    if (!args.output_file) {
+        args.usage();
+    }
+
+    // Allocate buffers, open files
+    unsigned char* buf = new unsigned char[args.block_size];
+    unsigned char* cbuf = new unsigned char[args.block_size];
+    FILE* inf = stdio_open_check(args.input_file, O_RDONLY);
+    io61_file* wf[2];
+    wf[0] = io61_open_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
+    wf[1] = io61_open_check(args.output_file, O_RDWR);
+    io61_file* rf = io61_open_check(args.output_file, O_RDONLY);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+
+    off_t end = 0;
+    for (int i = 0; args.file_size > 0; i = !i) {
+        size_t n = fread(buf, 1, std::min(args.block_size, args.file_size),
+                         inf);
+        if (n == 0) {
+            break;
+        }
+        args.file_size -= n;
+
+        // Write the block past end of file
+        end += args.initial_offset;
+        int r = io61_seek(wf[i], end);
+        assert(r == 0);
+        ssize_t nw = io61_write(wf[i], buf, n);
+        assert(nw == (ssize_t) n);
+        end += n;
+
+        // Follow: read on from where the last block's copy stopped
+        while (true) {
+            ssize_t nr = io61_read(rf, cbuf, args.block_size);
+            assert(nr >= 0);
+            if (nr == 0) {
+                break;
+            }
+            nw = io61_write(outf, cbuf, nr);
+            assert(nw == nr);
+        }
+        args.after_write(outf);
+    }
+
+    fclose(inf);
+    io61_close(rf);
+    io61_close(wf[0]);
+    io61_close(wf[1]);
+    io61_close(outf);
+    delete[] buf;
+    delete[] cbuf;
+}
@@ -1,8 +1,11 @@
 #include "io61.hh"
-#include <sys/time.h>
-#include <sys/resource.h>
+#include "bench61.hh"
+#include <ctime>
+#include <cmath>
 #include <csignal>
 #include <cerrno>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 // helpers.cc
 //    The io61_args() structure parses command line arguments.
@@ -111,6 +114,9 @@ io61_args& io61_args::parse(int argc, char** argv) {
         case 'F':
             this->flush = true;
             break;
+        case 'c':
+            this->copy = true;
+            break;
         case 'y':
             ++this->yield;
             break;
@@ -237,6 +243,9 @@ void io61_args::usage() {
     if (strchr(this->opts, 'F')) {
         fprintf(stderr, "    -F            Flush after each write\n");
     }
+    if (strchr(this->opts, 'c')) {
+        fprintf(stderr, "    -c            Copy with io61_copy\n");
+    }
     if (strchr(this->opts, 'y')) {
         fprintf(stderr, "    -y            Yield after each write\n");
     }
@@ -321,6 +330,8 @@ namespace {
 
 struct io61_profiler {
     double begin_at;
+    bench61_cycle_counter cycles;
+    uint64_t begin_cycles;
     io61_profiler();
     ~io61_profiler();
 };
@@ -329,51 +340,28 @@ static io61_profiler profiler_instance;
 
 io61_profiler::io61_profiler() {
     this->begin_at = monotonic_timestamp();
+    this->begin_cycles = this->cycles.read();
 }
 
 io61_profiler::~io61_profiler() {
     // Measure elapsed real, user, and system times, and report the result
-    // as JSON to file descriptor 100 if it’s available.
-
-    double real_elapsed = monotonic_timestamp() - this->begin_at;
+    // as a one-trial bench61 record to file descriptor 100 if it’s
+    // available.
 
-    struct rusage usage;
-    int r = getrusage(RUSAGE_SELF, &usage);
-    assert(r == 0);
-
-    struct rusage cusage;
-    r = getrusage(RUSAGE_CHILDREN, &cusage);
-    assert(r == 0);
-    timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
-    timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
-
-    long maxrss = usage.ru_maxrss + cusage.ru_maxrss;
-#if __MACH__
-    maxrss = (maxrss + 1023) / 1024;
+#if __GLIBC__
+    bench61_record rec(program_invocation_short_name);
+#else
+    bench61_record rec(getprogname());
 #endif
+    rec.times.push_back(monotonic_timestamp() - this->begin_at);
+    rec.cycles.push_back(this->cycles.read() - this->begin_cycles);
+    rec.cycles_source = this->cycles.source;
 
-    char buf[1000];
-    ssize_t len = snprintf(buf, sizeof(buf),
-        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
-        real_elapsed,
-        usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
-        usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-        maxrss);
-
-    off_t off = lseek(100, 0, SEEK_CUR);
-    int fd = (off != (off_t) -1 || errno == ESPIPE ? 100 : STDERR_FILENO);
-    if (fd == STDERR_FILENO && !getenv("TIMING")) {
-        return;
-    } else if (fd == STDERR_FILENO) {
-        fflush(stderr);
-    }
-    while (true) {
-        ssize_t nw = write(fd, buf, len);
-        if (nw == len) {
-            break;
-        }
-        assert(nw == -1 && (errno == EINTR || errno == EAGAIN));
+    int fd = bench61_output_fd();
+    if (fd < 0 && getenv("TIMING")) {
+        fd = STDERR_FILENO;
     }
+    rec.emit(fd);
 }
 
 }
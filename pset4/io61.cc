@@ -1,105 +1,2497 @@
 #include "io61.hh"
+#include "bench61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <algorithm>
 #include <climits>
 #include <cerrno>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // io61.cc
 //    YOUR CODE HERE!
 
 
+// io61_slot
+//    One cache slot: up to `bufsize` bytes of file data.
+
+struct io61_slot {
+    off_t off = -1;         // file offset of `data[0]`, or -1 if unused
+    off_t len = 0;          // number of valid bytes (read and read/write
+                            //   files)
+    off_t lo = 0;           // dirty range `[lo, hi)` (write and read/write
+    off_t hi = 0;           //   files); the slot is clean if `lo == hi`
+    bool sparse = false;    // only some of `[lo, hi)` is dirty (see
+    unsigned nsparse = 0;   //   io61_cache::dirtymap); how many bytes
+    bool whole = false;     // was read from the file, so `len` is where
+                            //   the file ended if `len < bufsize`
+    unsigned char* data;
+    int next = -1;          // next slot in hash chain, or -1
+    bool ref = false;       // CLOCK reference bit
+    bool busy = false;      // in use by the helper thread (async mode)
+};
+
+// io61_maxrun
+//    The most slots one system call reads or writes (1 MiB).
+
+static constexpr size_t io61_maxrun = 256;
+
+// io61_direct_min
+//    Reads and writes of at least this many bytes (64 KiB) that miss the
+//    cache go directly between the caller's buffers and the file. Smaller
+//    ones go through the cache, so that many of them share a system call.
+
+static constexpr size_t io61_direct_min = 64 << 10;
+
+
+// io61_async
+//    Async mode state: a helper thread, and the one operation it may
+//    have in flight, which reads or writes the `count` slots in `run` at
+//    file offset `off` (or at `fd`'s file offset, if `off < 0`). While
+//    an operation is in flight its slots are `busy`, and the main thread
+//    makes no system calls on `fd` until io61_wait collects the result.
+
+struct io61_async {
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    bool pending = false;   // operation submitted and not finished
+    bool stop = false;      // helper thread should exit
+    bool orphan = false;    // helper thread owns `fd` and `data`
+    int fd;
+    unsigned char* data = nullptr;
+
+    bool busy = false;      // operation submitted and not collected
+    bool write;
+    off_t off;
+    io61_slot* run[io61_maxrun];
+    iovec iov[io61_maxrun];
+    size_t count;
+    ssize_t result;
+    io61_statistics stats;  // the helper's system calls since io61_wait
+};
+
+
+// io61_cache
+//    A file's cache slots, found by aligned file offset through
+//    `buckets` and replaced with the CLOCK algorithm. Dirty slots are
+//    written in offset order when one of them must be replaced, or on
+//    flush. Unseekable files read into a ring of slots tagged with
+//    unaligned stream offsets, and write through a single slot.
+//
+//    Files opened on the same regular file (same `st_dev` and `st_ino`)
+//    share one cache, so they share clean slots and see each other's
+//    writes. In a shared cache, slot data is valid file data for
+//    `[off, off + len)` plus the dirty bytes; a read past `len` writes
+//    the dirty bytes and rereads the slot (see io61_reread), and a read
+//    that comes up short first writes every file's pending bytes (see
+//    io61_flush_eof). Files in async or O_DIRECT mode keep private
+//    caches.
+
+struct io61_cache {
+    std::vector<io61_slot> slots;
+    std::vector<int> buckets;   // size is a power of two
+    unsigned char* data = nullptr;
+    size_t datasize = 0;        // bytes allocated at `data` (io61_pool)
+    unsigned hand = 0;          // CLOCK hand
+    unsigned ndirty = 0;        // number of dirty slots
+    // Dirty bitmaps for sparse slots (write files), `bufsize / 64` words
+    // per slot, allocated when first needed.
+    std::vector<uint64_t> dirtymap;
+
+    bool shareable = false;     // listed in `io61_caches`
+    dev_t dev;
+    ino_t ino;
+    std::vector<io61_file*> files;  // files using this cache
+    io61_file* writer = nullptr;    // a file that can write dirty slots
+};
+
+
+struct io61_zstream;
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
+//
+//    The cache window (io61_window, in io61.hh), which the inline
+//    io61_readc and io61_writec use on every call, comes first and shares
+//    a cache line with the fields io61_read and io61_write use.
 
-struct io61_file {
-    int fd;     // file descriptor
-
+struct alignas(64) io61_file : io61_window {
+    // Cache window: the slot that the next readc/writec will use.
+    // Read windows: `tag <= pos_tag <= end_tag`, and `buf[pos_tag - tag]`
+    // is the next byte if `pos_tag < end_tag`; `wend_tag == 0`.
+    // Write windows: `pos_tag == end_tag`; if `cur != nullptr`, the bytes
+    // `[wstart, end_tag)` have been written into `cur` since the window
+    // was opened, and the cache has room for `wend_tag - end_tag` more
+    // bytes (`wend_tag == tag + bufsize`; otherwise `wend_tag == 0`).
+    // Releasing the window merges those bytes into `cur`'s dirty range
+    // (in write files, into its dirty bitmap if the two aren't
+    // contiguous).
+    // Read/write (O_RDWR) files open either kind of window. Their slots
+    // always hold the file's data (slots are read before being written),
+    // so reads see cached writes, and a dirty range may cover clean bytes.
     static constexpr off_t bufsize = 4096;
-    unsigned char cbuf[bufsize];
+    io61_slot* cur = nullptr;
+    off_t wstart;   // start of window's new bytes (write files)
     int mode;
 
-    off_t tag;      // file offset of first byte in cache (0 when file is opened)
-    off_t end_tag;  // file offset one past last valid byte in cache
-    off_t pos_tag;  // file offset of next char to read in cache
-};
+    int fd;     // file descriptor
+    bool seekable;
+    bool regular;           // is `fd` a regular file?
+    bool odirect = false;   // is `fd` in O_DIRECT mode?
+    off_t fd_pos;           // `fd`'s file offset, if seekable
+
+    io61_cache* cache = nullptr; // slots, possibly shared (io61_cache)
+    // Readahead: fills read runs of `ra` slots while access is
+    // sequential (see io61_fill).
+    off_t fill_lo = -1;         // first offset read by the last fill
+    off_t fill_hi = -1;         // offset after the last byte it read
+    bool fill_full = false;     // did it read everything it asked for?
+    unsigned ra = 1;            // forward run length in slots
+    unsigned back = 0;          // consecutive fills that moved backwards
+
+    io61_async* async = nullptr;    // non-null in async mode
+    off_t wb_next = -1;         // offset after the last fully written slot
+    unsigned wb_run = 0;        //   and number of such slots in a row
+    int nocopy_fd = -1;         // io61_copy can't copy from here to this
+                                //   fd in the kernel
+    int relay[2] = {-1, -1};    // pipe for io61_copy from a socket
+    std::vector<unsigned char> line;    // io61_peekline's line when it
+                                        //   spans windows
+    bool line_held = false;     // `line` is incomplete (nonblocking read)
+    io61_statistics stats;      // see io61_stats
+    io61_zstream* z = nullptr;  // non-null in compressed mode
+
+    // mmap mode: a read-only regular file is mapped whole, and the window
+    // is the entire file (`tag == 0`, `end_tag ==` file size). Seeks just
+    // move `pos_tag`. A file that leaves mmap mode (io61_share) keeps its
+    // mapping until closed.
+    bool mapped = false;
+    unsigned char* map = nullptr;
+    off_t maplen;
+    int advice;         // current madvise advice
+    off_t run_start;    // `pos_tag` after the last seek
+    unsigned jumps;     // recent seeks that ended a short sequential run
+};
+
+
+// io61_check_invariants(f)
+//    Asserts the cache invariants listed above.
+
+static inline void io61_check_invariants(io61_file* f) {
+    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
+    if (f->z) {
+        return;     // compressed mode windows hold a whole frame
+    }
+    assert(f->mapped || f->end_tag - f->tag <= f->bufsize);
+    assert(f->mode != O_WRONLY || f->pos_tag == f->end_tag);
+    assert(f->mode != O_WRONLY || f->wend_tag == (f->cur ? f->tag + f->bufsize : 0));
+    assert(f->mode != O_RDONLY || f->wend_tag == 0);
+    assert(f->wend_tag == 0
+           || (f->cur && f->wend_tag == f->tag + f->bufsize
+               && f->pos_tag == f->end_tag
+               && f->tag <= f->wstart && f->wstart <= f->end_tag));
+}
+
+
+// io61_undirect(fd)
+//    Turns off O_DIRECT for `fd`. Returns true if it had been on.
+
+static bool io61_undirect(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    return fl >= 0 && (fl & O_DIRECT)
+        && fcntl(fd, F_SETFL, fl & ~O_DIRECT) == 0;
+}
+
+
+// io61_count(st, n, start)
+//    Counts a data system call, begun at time `start`, that returned `n`.
+
+static void io61_count(io61_statistics* st, ssize_t n, double start) {
+    ++st->syscalls;
+    int k = 0;
+    if (n > 0) {
+        st->bytes += n;
+        k = std::min(64 - __builtin_clzll(n), 23);
+    }
+    ++st->hist[k];
+    st->blocked += bench61_now() - start;
+}
+
+
+// io61_add_stats(st, x)
+//    Adds the counters in `x` to `st`.
+
+static void io61_add_stats(io61_statistics* st, const io61_statistics& x) {
+    st->syscalls += x.syscalls;
+    st->bytes += x.bytes;
+    for (int k = 0; k != 24; ++k) {
+        st->hist[k] += x.hist[k];
+    }
+    st->hits += x.hits;
+    st->misses += x.misses;
+    st->seek_hits += x.seek_hits;
+    st->seek_misses += x.seek_misses;
+    st->blocked += x.blocked;
+}
+
+
+// io61_faults
+//    Simulated storage, for testing and benchmarking io61 under slow or
+//    unreliable system calls. The environment variable `IO61_FAULTS`
+//    turns it on; it holds comma-separated settings:
+//
+//    seed=N       random seed (default 1), so runs repeat
+//    lat=S        each data system call takes at least S seconds,
+//    jitter=S     plus an exponentially distributed delay with mean S,
+//    tail=P:S     plus, with probability P, another S seconds
+//    bw=B         data moves at B bytes per second, shared by all files
+//                 as if they lived on one device
+//    short=P      with probability P, a call moves only part of its data
+//    eintr=P      with probability P, a call fails with EINTR
+//    eagain=P     with probability P, a call fails with EAGAIN
+//                 (nonblocking files only)
+//    storm=N      an injected error repeats for up to N calls in a row
+//
+//    Short reads hit every kind of file, since io61 only takes a read
+//    that returns 0 to mean end of file. The data itself still comes
+//    from the file; for in-memory storage, put it on tmpfs (say,
+//    /dev/shm). Data that would bypass io61_transfer, through mmap mode
+//    or kernel copies, is not served that way while faults are on.
+
+struct io61_faults {
+    std::mutex m;
+    std::mt19937_64 rng{1};
+    double lat = 0;
+    double jitter = 0;
+    double tail_p = 0;
+    double tail = 0;
+    double bw = 0;
+    double short_p = 0;
+    double eintr_p = 0;
+    double eagain_p = 0;
+    unsigned storm = 1;
+
+    unsigned storm_left = 0;    // calls left in the current error storm
+    int storm_errno;
+    double device_free = 0;     // when the device finishes its backlog
+                                //   (`bw`)
+
+    bool chance(double p) {
+        return p > 0
+            && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+    }
+};
+
+static io61_faults* io61_get_faults() {
+    static io61_faults* faults = [] () -> io61_faults* {
+        const char* env = getenv("IO61_FAULTS");
+        if (!env || !*env) {
+            return nullptr;
+        }
+        io61_faults* fl = new io61_faults;
+        std::string spec = env;
+        size_t pos = 0;
+        while (pos < spec.size()) {
+            size_t comma = std::min(spec.find(',', pos), spec.size());
+            std::string item = spec.substr(pos, comma - pos);
+            pos = comma + 1;
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            const char* val = eq == std::string::npos ? "" : &item[eq + 1];
+            if (key == "seed") {
+                fl->rng.seed(strtoull(val, nullptr, 0));
+            } else if (key == "lat") {
+                fl->lat = strtod(val, nullptr);
+            } else if (key == "jitter") {
+                fl->jitter = strtod(val, nullptr);
+            } else if (key == "tail") {
+                char* end;
+                fl->tail_p = strtod(val, &end);
+                fl->tail = *end == ':' ? strtod(end + 1, nullptr) : 0;
+            } else if (key == "bw") {
+                fl->bw = strtod(val, nullptr);
+            } else if (key == "short") {
+                fl->short_p = strtod(val, nullptr);
+            } else if (key == "eintr") {
+                fl->eintr_p = strtod(val, nullptr);
+            } else if (key == "eagain") {
+                fl->eagain_p = strtod(val, nullptr);
+            } else if (key == "storm") {
+                fl->storm = std::max(strtoul(val, nullptr, 0), 1UL);
+            } else if (!key.empty()) {
+                fprintf(stderr, "IO61_FAULTS: unknown setting `%s`\n",
+                        key.c_str());
+            }
+        }
+        return fl;
+    }();
+    return faults;
+}
+
+
+// io61_syscall(fd, write, iov, iovcnt, off)
+//    Makes the system call io61_transfer wants: a readv or writev at
+//    `fd`'s file offset if `off < 0`, and otherwise a preadv or pwritev.
+
+static ssize_t io61_syscall(int fd, bool write, const iovec* iov, int iovcnt,
+                            off_t off) {
+    if (write) {
+        return off < 0 ? writev(fd, iov, iovcnt)
+            : pwritev(fd, iov, iovcnt, off);
+    } else {
+        return off < 0 ? readv(fd, iov, iovcnt) : preadv(fd, iov, iovcnt, off);
+    }
+}
+
+
+// io61_inject(fl, fd, write, iov, iovcnt, off)
+//    Makes the system call io61_syscall would, subject to the simulated
+//    storage `fl`: it may fail, move less data, or take longer.
+
+static ssize_t io61_inject(io61_faults* fl, int fd, bool write,
+                           const iovec* iov, int iovcnt, off_t off) {
+    int fdfl = fl->eagain_p > 0 ? fcntl(fd, F_GETFL) : 0;
+    bool nonblocking = fdfl >= 0 && (fdfl & O_NONBLOCK);
+    size_t total = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+
+    std::unique_lock<std::mutex> guard(fl->m);
+    int err = 0;
+    if (fl->storm_left > 0
+        && (fl->storm_errno != EAGAIN || nonblocking)) {
+        --fl->storm_left;
+        err = fl->storm_errno;
+    } else if (fl->chance(fl->eintr_p)) {
+        err = EINTR;
+    } else if (nonblocking && fl->chance(fl->eagain_p)) {
+        err = EAGAIN;
+    }
+    if (err && fl->storm_left == 0 && fl->storm > 1) {
+        fl->storm_left = fl->rng() % fl->storm;
+        fl->storm_errno = err;
+    }
+    size_t want = total;
+    if (!err && total > 1 && fl->chance(fl->short_p)) {
+        want = 1 + fl->rng() % (total - 1);
+    }
+    double delay = fl->lat;
+    if (fl->jitter > 0) {
+        std::exponential_distribution<double> exp(1 / fl->jitter);
+        delay += exp(fl->rng);
+    }
+    if (fl->chance(fl->tail_p)) {
+        delay += fl->tail;
+    }
+    guard.unlock();
+
+    double start = bench61_now();
+    ssize_t n = -1;
+    if (!err) {
+        std::vector<iovec> v(iov, iov + iovcnt);
+        int cnt = 0;
+        for (size_t left = want; cnt != iovcnt && left > 0; ++cnt) {
+            v[cnt].iov_len = std::min(v[cnt].iov_len, left);
+            left -= v[cnt].iov_len;
+        }
+        n = io61_syscall(fd, write, v.data(), total ? cnt : iovcnt, off);
+        err = n < 0 ? errno : 0;
+    }
+    double done = start + delay;
+    if (fl->bw > 0 && n > 0) {
+        guard.lock();
+        fl->device_free = std::max(fl->device_free, start) + n / fl->bw;
+        done = std::max(done, fl->device_free);
+        guard.unlock();
+    }
+    double now = bench61_now();
+    if (done > now) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(done - now));
+    }
+    errno = err;
+    return n;
+}
+
+
+// io61_transfer(fd, write, iov, iovcnt, off, st)
+//    Reads or writes `iov` at file offset `off`, or at `fd`'s file offset
+//    if `off < 0`, retrying after signals, and counts the system calls
+//    in `st`. If a filesystem that accepted
+//    O_DIRECT refuses an O_DIRECT transfer, falls back to buffered I/O.
+//    A read makes one system call and returns its result. A write
+//    continues until everything is written or an error occurs (including
+//    EAGAIN from a nonblocking fd), and returns the number of bytes
+//    written. The helper thread of async mode calls this too, and so
+//    does every data system call on simulated storage (io61_faults).
+
+static ssize_t io61_transfer(int fd, bool write, iovec* iov, int iovcnt,
+                             off_t off, io61_statistics* st) {
+    size_t pos = 0;
+    while (iovcnt > 0) {
+        ssize_t n;
+        double start = bench61_now();
+        off_t at = off < 0 ? off : off + pos;
+        if (io61_faults* fl = io61_get_faults()) {
+            n = io61_inject(fl, fd, write, iov, iovcnt, at);
+        } else {
+            n = io61_syscall(fd, write, iov, iovcnt, at);
+        }
+        io61_count(st, n, start);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EINVAL && io61_undirect(fd)) {
+            continue;
+        } else if (!write) {
+            return n;
+        } else if (n <= 0) {
+            break;
+        }
+        pos += n;
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return pos;
+}
+
+static void io61_wait(io61_file* f);
+
+// io61_read_at(f, iov, iovcnt, off), io61_write_at(f, iov, iovcnt, off)
+//    Transfer data at file offset `off`. When `off` is `fd`'s current
+//    offset (always true for unseekable files), use plain read/write, so
+//    sequential access keeps the file offset in sync; otherwise use the
+//    positioned variants. io61_read_at returns as io61_read does;
+//    io61_write_at writes everything unless an error occurs and returns
+//    the number of bytes written. Both first wait for any operation in
+//    flight. In O_DIRECT mode, reads are always of whole aligned slots
+//    (the last may come up short at end of file), but writes need not be.
+
+static ssize_t io61_read_at(io61_file* f, iovec* iov, int iovcnt, off_t off) {
+    io61_wait(f);
+    bool at_pos = !f->seekable || off == f->fd_pos;
+    ssize_t n = io61_transfer(f->fd, false, iov, iovcnt, at_pos ? -1 : off,
+                              &f->stats);
+    if (at_pos && n > 0) {
+        f->fd_pos += n;
+    }
+    return n;
+}
+
+// io61_read_full(f, iov, iovcnt, off)
+//    Reads into `iov` at file offset `off` as io61_read_at does, but
+//    keeps reading a seekable file until `iov` is full or a read returns
+//    0: a short read from a seekable file need not be its end (simulated
+//    storage makes them, for one). Returns the number of bytes read,
+//    which is short only at end of file, or -1 on error. `iov` is
+//    consumed.
+
+static ssize_t io61_read_full(io61_file* f, iovec* iov, int iovcnt,
+                              off_t off) {
+    size_t pos = 0;
+    while (iovcnt > 0) {
+        ssize_t n = io61_read_at(f, iov, iovcnt, off + pos);
+        if (n < 0) {
+            return -1;
+        } else if (n == 0 || !f->seekable) {
+            return pos + n;
+        }
+        pos += n;
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return pos;
+}
+
+static size_t io61_write_span(io61_file* f, iovec* iov, int iovcnt,
+                              off_t off) {
+    bool at_pos = !f->seekable || off == f->fd_pos;
+    size_t n = io61_transfer(f->fd, true, iov, iovcnt, at_pos ? -1 : off,
+                             &f->stats);
+    if (at_pos) {
+        f->fd_pos += n;
+    }
+    return n;
+}
+
+static size_t io61_write_at(io61_file* f, iovec* iov, int iovcnt, off_t off) {
+    io61_wait(f);
+    if (!f->odirect) {
+        return io61_write_span(f, iov, iovcnt, off);
+    }
+
+    // O_DIRECT writes need whole blocks at aligned offsets from aligned
+    // memory. Each element of `iov` lies within one slot, so only the
+    // first can start mid-block and only the last can end mid-block.
+    // Those partial blocks go through the page cache, with O_DIRECT off
+    // for the write: a write-only file can't read back the rest of the
+    // block to pad them.
+    auto whole = [&] (const iovec& v, off_t o) {
+        return o % f->bufsize == 0
+            && v.iov_len % f->bufsize == 0
+            && (uintptr_t) v.iov_base % f->bufsize == 0;
+    };
+    size_t pos = 0;
+    int i = 0;
+    while (i != iovcnt) {
+        bool w = whole(iov[i], off + pos);
+        int j = i;
+        size_t len = 0;
+        while (j != iovcnt && whole(iov[j], off + pos + len) == w) {
+            len += iov[j].iov_len;
+            ++j;
+        }
+        int fl = w ? -1 : fcntl(f->fd, F_GETFL);
+        bool toggle = fl >= 0 && (fl & O_DIRECT)
+            && fcntl(f->fd, F_SETFL, fl & ~O_DIRECT) == 0;
+        size_t n = io61_write_span(f, &iov[i], j - i, off + pos);
+        if (toggle) {
+            fcntl(f->fd, F_SETFL, fl);
+        }
+        pos += n;
+        if (n != len) {
+            break;
+        }
+        i = j;
+    }
+    return pos;
+}
+
+
+// io61_set_window(f, s, pos, write)
+//    Points the cache window at slot `s` (or nowhere, if `s` is null),
+//    with file position `pos`. The window is a write window if `write`.
+
+static void io61_set_window(io61_file* f, io61_slot* s, off_t pos,
+                            bool write = false) {
+    if (s) {
+        f->buf = s->data;
+        f->tag = s->off;
+        f->end_tag = write ? pos : s->off + s->len;
+        f->wstart = pos;
+    } else {
+        f->tag = f->end_tag = pos;
+    }
+    f->wend_tag = s && write ? s->off + f->bufsize : 0;
+    f->cur = s;
+    f->pos_tag = pos;
+}
+
+// io61_dirty_bits(f, s)
+//    Returns slot `s`'s dirty bitmap.
+
+static uint64_t* io61_dirty_bits(io61_file* f, io61_slot* s) {
+    constexpr size_t nwords = io61_file::bufsize / 64;
+    if (f->cache->dirtymap.empty()) {
+        f->cache->dirtymap.resize(f->cache->slots.size() * nwords);
+    }
+    return &f->cache->dirtymap[(s - f->cache->slots.data()) * nwords];
+}
+
+// io61_set_bits(bits, a, b)
+//    Sets bits `[a, b)` of `bits`. Returns how many were clear.
+
+static unsigned io61_set_bits(uint64_t* bits, off_t a, off_t b) {
+    unsigned nset = 0;
+    while (a < b) {
+        unsigned n = std::min((off_t) 64 - a % 64, b - a);
+        uint64_t mask = (n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1)
+            << (a % 64);
+        nset += __builtin_popcountll(mask & ~bits[a / 64]);
+        bits[a / 64] |= mask;
+        a += n;
+    }
+    return nset;
+}
+
+// io61_mark_sparse(f, s, lo, hi)
+//    Adds bytes `[lo, hi)` to write slot `s`'s dirty bytes, which need
+//    not be contiguous with them, switching the slot to its dirty bitmap
+//    if necessary. The slot goes back to a plain range once the bitmap
+//    has no holes.
+
+static void io61_mark_sparse(io61_file* f, io61_slot* s, off_t lo, off_t hi) {
+    uint64_t* bits = io61_dirty_bits(f, s);
+    if (!s->sparse) {
+        memset(bits, 0, f->bufsize / 8);
+        s->sparse = true;
+        s->nsparse = io61_set_bits(bits, s->lo - s->off, s->hi - s->off);
+    }
+    s->nsparse += io61_set_bits(bits, lo - s->off, hi - s->off);
+    s->lo = std::min(s->lo, lo);
+    s->hi = std::max(s->hi, hi);
+    if (s->nsparse == s->hi - s->lo) {
+        s->sparse = false;
+    }
+}
+
+// io61_next_extent(f, s, lo, hi)
+//    Sets `[*lo, *hi)` to the first run of dirty bytes in slot `s` that
+//    starts at or after `*lo`. Returns false if there is none.
+
+static bool io61_next_extent(io61_file* f, io61_slot* s, off_t* lo,
+                             off_t* hi) {
+    if (!s->sparse) {
+        *hi = s->hi;
+        return *lo < s->hi && (*lo = std::max(*lo, s->lo), true);
+    }
+    const uint64_t* bits = io61_dirty_bits(f, s);
+    off_t end = s->hi - s->off;
+    // find the next set bit, then the next clear bit
+    off_t i = std::max(*lo, s->lo) - s->off;
+    for (int want = 1; want >= 0; --want) {
+        while (i < end) {
+            uint64_t x = want ? bits[i / 64] : ~bits[i / 64];
+            x &= ~(uint64_t) 0 << (i % 64);
+            if (x) {
+                i = std::min(end, (i / 64) * 64 + __builtin_ctzll(x));
+                break;
+            }
+            i = (i / 64 + 1) * 64;
+        }
+        i = std::min(i, end);
+        if (want) {
+            if (i == end) {
+                return false;
+            }
+            *lo = s->off + i;
+        }
+    }
+    *hi = s->off + i;
+    return true;
+}
+
+// io61_release(f)
+//    Detaches the window from its slot, merging the bytes written
+//    through it into the slot's dirty range (or, if the two aren't
+//    contiguous and the bytes between them aren't valid, its dirty
+//    bitmap). Bytes written at the end of the slot's valid data extend
+//    it.
+
+static void io61_release(io61_file* f) {
+    io61_slot* s = f->cur;
+    if (s && f->wend_tag && f->wstart != f->end_tag) {
+        if (s->lo == s->hi) {
+            s->lo = f->wstart;
+            s->hi = f->end_tag;
+            ++f->cache->ndirty;
+        } else if (!s->sparse
+                   && ((f->mode == O_RDWR && s->whole)
+                       || std::max(s->lo, f->wstart) <= s->off + s->len
+                       || (f->wstart <= s->hi && f->end_tag >= s->lo))) {
+            s->lo = std::min(s->lo, f->wstart);
+            s->hi = std::max(s->hi, f->end_tag);
+        } else {
+            io61_mark_sparse(f, s, f->wstart, f->end_tag);
+        }
+        // (read/write files zero the bytes they skip past end of file)
+        if (f->mode == O_RDWR || f->wstart <= s->off + s->len) {
+            s->len = std::max(s->len, f->end_tag - s->off);
+        } else {
+            s->whole = false;
+        }
+        if (f->async && !s->sparse
+            && s->lo == s->off && s->hi == s->off + f->bufsize) {
+            f->wb_run = s->off == f->wb_next ? f->wb_run + 1 : 1;
+            f->wb_next = s->hi;
+        }
+    }
+    io61_set_window(f, nullptr, f->pos_tag);
+}
+
+
+// io61_detach_peers(f, s)
+//    Releases the windows other files sharing `f`'s cache have on slot
+//    `s`, so that `f` can replace or reread it.
+
+static void io61_detach_peers(io61_file* f, io61_slot* s) {
+    for (auto g : f->cache->files) {
+        if (g != f && g->cur == s) {
+            io61_release(g);
+        }
+    }
+}
+
+
+// io61_find(f, off)
+//    Returns the slot caching aligned file offset `off`, or nullptr.
+
+static io61_slot* io61_find(io61_file* f, off_t off) {
+    size_t b = (off / f->bufsize) & (f->cache->buckets.size() - 1);
+    for (int i = f->cache->buckets[b]; i >= 0; i = f->cache->slots[i].next) {
+        if (f->cache->slots[i].off == off) {
+            f->cache->slots[i].ref = true;
+            return &f->cache->slots[i];
+        }
+    }
+    return nullptr;
+}
+
+static void io61_unlink(io61_file* f, io61_slot* s);
+
+// io61_shared(f)
+//    Returns true if another file shares `f`'s cache. Reads and writes
+//    that bypass the cache would miss (or invalidate) the other files'
+//    slots, so shared files don't make them.
+
+static inline bool io61_shared(io61_file* f) {
+    return f->cache->files.size() > 1;
+}
+
+// io61_invalidate(f, lo, hi)
+//    Drops the clean slots caching any of `[lo, hi)`, which was just
+//    written around the cache.
+
+static void io61_invalidate(io61_file* f, off_t lo, off_t hi) {
+    if (!f->seekable || lo >= hi) {
+        return;
+    }
+    auto& slots = f->cache->slots;
+    if ((size_t) ((hi - lo) / f->bufsize) > slots.size()) {
+        for (auto& s : slots) {
+            if (s.off >= 0 && s.off < hi && s.off + f->bufsize > lo) {
+                io61_unlink(f, &s);
+            }
+        }
+    } else {
+        for (off_t off = lo - lo % f->bufsize; off < hi; off += f->bufsize) {
+            if (io61_slot* s = io61_find(f, off)) {
+                io61_unlink(f, s);
+            }
+        }
+    }
+}
+
+// io61_written(f, run, count, n)
+//    Marks the first `n` bytes written from the dirty ranges of the
+//    `count` slots in `run` clean. Returns true if all of them are clean.
+
+static bool io61_written(io61_file* f, io61_slot* const* run, size_t count,
+                         size_t n) {
+    bool clean = true;
+    for (size_t i = 0; i != count; ++i) {
+        io61_slot* s = run[i];
+        size_t k = std::min(n, (size_t) (s->hi - s->lo));
+        s->lo += k;
+        n -= k;
+        if (s->lo == s->hi) {
+            --f->cache->ndirty;
+        } else {
+            clean = false;
+        }
+    }
+    return clean;
+}
+
+// io61_flush_dirty(f)
+//    Writes all dirty bytes in file offset order, combining extents that
+//    are adjacent in the file (within a sparse slot or across slots)
+//    into single system calls. A read-only file sharing its cache writes
+//    through the cache's writer. Returns 0 on success and -1 on error.
+
+static int io61_flush_dirty(io61_file* f) {
+    io61_wait(f);
+    if (f->cache->ndirty == 0) {
+        return 0;
+    }
+    io61_file* w = f->mode != O_RDONLY ? f : f->cache->writer;
+    std::vector<io61_slot*> dirty;
+    for (auto& s : f->cache->slots) {
+        if (s.lo < s.hi) {
+            dirty.push_back(&s);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [] (io61_slot* a, io61_slot* b) {
+        return a->lo < b->lo;
+    });
+    struct extent {
+        io61_slot* s;
+        off_t lo, hi;
+    };
+    std::vector<extent> ext;
+    for (auto s : dirty) {
+        off_t lo = s->lo, hi;
+        while (io61_next_extent(f, s, &lo, &hi)) {
+            ext.push_back({s, lo, hi});
+            lo = hi;
+        }
+    }
+
+    iovec iov[io61_maxrun];
+    size_t i = 0;
+    while (i != ext.size()) {
+        // collect a run of contiguous extents
+        size_t j = i;
+        while (j != ext.size() && j - i != io61_maxrun
+               && (j == i || ext[j].lo == ext[j - 1].hi)) {
+            iov[j - i].iov_base = &ext[j].s->data[ext[j].lo - ext[j].s->off];
+            iov[j - i].iov_len = ext[j].hi - ext[j].lo;
+            ++j;
+        }
+        size_t n = io61_write_at(w, iov, j - i, ext[i].lo);
+        // mark slots clean once their last extent is written
+        for (; i != j; ++i) {
+            io61_slot* s = ext[i].s;
+            size_t k = std::min(n, (size_t) (ext[i].hi - ext[i].lo));
+            n -= k;
+            if (k != (size_t) (ext[i].hi - ext[i].lo)) {
+                if (!s->sparse) {
+                    s->lo += k;
+                }
+                return -1;
+            } else if (ext[i].hi == s->hi) {
+                s->lo = s->hi;
+                s->sparse = false;
+                --f->cache->ndirty;
+            }
+        }
+    }
+    return 0;
+}
+
+// io61_unlink(f, s)
+//    Removes clean slot `s` from its hash chain, leaving it unused.
+
+static void io61_unlink(io61_file* f, io61_slot* s) {
+    assert(s->lo == s->hi);
+    if (s->off >= 0) {
+        io61_cache* c = f->cache;
+        int* pp = &c->buckets[(s->off / f->bufsize) & (c->buckets.size() - 1)];
+        while (*pp != s - c->slots.data()) {
+            pp = &c->slots[*pp].next;
+        }
+        *pp = s->next;
+        s->off = -1;
+    }
+}
+
+// io61_replace(f, off)
+//    Chooses a slot to cache file offset `off`, writing dirty slots
+//    first if the chosen slot is dirty. Busy slots are skipped (if every
+//    slot is busy, waits for the operation in flight). The window must be
+//    released, and other files' windows on the slot are. Returns the slot
+//    (with no valid data), or nullptr on error.
+
+static io61_slot* io61_replace(io61_file* f, off_t off) {
+    assert(!f->cur);
+    io61_slot* s;
+    size_t nbusy = 0;
+    while (true) {
+        s = &f->cache->slots[f->cache->hand];
+        f->cache->hand = (f->cache->hand + 1) % f->cache->slots.size();
+        if (s->busy) {
+            if (++nbusy == f->cache->slots.size()) {
+                io61_wait(f);
+            }
+        } else if (!s->ref) {
+            break;
+        } else {
+            s->ref = false;
+        }
+    }
+    io61_detach_peers(f, s);
+    if (s->lo != s->hi && io61_flush_dirty(f) < 0) {
+        return nullptr;
+    }
+
+    io61_unlink(f, s);
+    size_t b = (off / f->bufsize) & (f->cache->buckets.size() - 1);
+    s->next = f->cache->buckets[b];
+    f->cache->buckets[b] = s - f->cache->slots.data();
+    s->off = off;
+    s->len = s->lo = s->hi = 0;
+    s->whole = false;
+    s->ref = true;
+    return s;
+}
+
+
+// io61_reserve(f, first, count, run)
+//    Replaces `count` slots to cache consecutive slots starting at file
+//    offset `first`, none of which may be cached, and stores them in
+//    `run`. Returns 0 on success and -1 on error.
+
+static int io61_reserve(io61_file* f, off_t first, size_t count,
+                        io61_slot** run) {
+    assert(count > 0 && count <= io61_maxrun);
+    for (size_t i = 0; i != count; ++i) {
+        if (!(run[i] = io61_replace(f, first + i * f->bufsize))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// io61_loaded(f, run, count, n, eof)
+//    Records that `n` bytes (`n < 0` on error) were read into the
+//    reserved slots in `run`. Slots beyond the bytes actually read are
+//    left unused. `eof` says whether a short read stopped at end of
+//    file; if not, a partly read slot is not `whole`.
+
+static void io61_loaded(io61_file* f, io61_slot* const* run, size_t count,
+                        ssize_t n, bool eof) {
+    off_t first = run[0]->off;
+    n = std::max(n, (ssize_t) 0);
+    for (size_t i = 0; i != count; ++i) {
+        off_t len = n - (off_t) (i * f->bufsize);
+        run[i]->len = std::max((off_t) 0, std::min(len, f->bufsize));
+        run[i]->whole = eof || run[i]->len == f->bufsize;
+        if (run[i]->len == 0) {
+            io61_unlink(f, run[i]);
+        }
+    }
+    f->fill_lo = first;
+    f->fill_hi = first + n;
+    f->fill_full = (size_t) n == count * f->bufsize;
+}
+
+// io61_reread(f, s)
+//    Rereads slot `s` from the file, after writing its dirty bytes
+//    (including those other files have written into it). Returns 0 on
+//    success and -1 on error.
+
+static int io61_reread(io61_file* f, io61_slot* s) {
+    io61_detach_peers(f, s);
+    if (s->lo != s->hi && io61_flush_dirty(f) < 0) {
+        return -1;
+    }
+    iovec iov = {s->data, (size_t) f->bufsize};
+    ssize_t n = io61_read_full(f, &iov, 1, s->off);
+    if (n < 0) {
+        return -1;
+    }
+    s->len = n;
+    s->whole = true;
+    return 0;
+}
+
+// io61_load(f, first, count)
+//    Reads `count` consecutive slots, starting at file offset `first`,
+//    with one system call (more if a seekable file's read comes up
+//    short before end of file). None of them may be cached. Returns 0
+//    on success and -1 on error.
+
+static int io61_load(io61_file* f, off_t first, size_t count) {
+    io61_slot* run[io61_maxrun];
+    iovec iov[io61_maxrun];
+    if (io61_reserve(f, first, count, run) < 0) {
+        return -1;
+    }
+    for (size_t i = 0; i != count; ++i) {
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = f->bufsize;
+    }
+    ssize_t n = io61_read_full(f, iov, count, first);
+    io61_loaded(f, run, count, n, true);
+    return n < 0 ? -1 : 0;
+}
+
+// io61_flush_eof(f)
+//    Called when a read of seekable file `f` ends short of the slot it
+//    wanted. Dirty bytes in a later slot, including bytes still in the
+//    write windows of files sharing the cache, may lie past the file's
+//    end, so the short read is end of file only once they are written:
+//    merges those windows and writes all dirty bytes (through a writer,
+//    if `f` is read-only). Returns 1 if it wrote anything (the caller
+//    should read again), 0 if nothing was dirty, and -1 on error.
+
+static int io61_flush_eof(io61_file* f) {
+    for (auto g : f->cache->files) {
+        if (g != f && g->cur && g->wend_tag && g->wstart != g->end_tag) {
+            io61_release(g);
+        }
+    }
+    if (f->cache->ndirty == 0) {
+        return 0;
+    }
+    return io61_flush_dirty(f) < 0 ? -1 : 1;
+}
+
+
+// io61_async_main(a)
+//    The helper thread: performs submitted operations until told to
+//    stop. An orphaned helper (see io61_close) then cleans up after its
+//    file.
+
+static void io61_async_main(io61_async* a) {
+    std::unique_lock<std::mutex> guard(a->m);
+    while (true) {
+        a->cv.wait(guard, [a] { return a->pending || a->stop; });
+        if (a->stop) {
+            break;
+        }
+        guard.unlock();
+        ssize_t n = io61_transfer(a->fd, a->write, a->iov, a->count, a->off,
+                                  &a->stats);
+        guard.lock();
+        a->result = n;
+        a->pending = false;
+        a->cv.notify_all();
+    }
+    if (a->orphan) {
+        guard.unlock();
+        close(a->fd);
+        free(a->data);
+        delete a;
+    }
+}
+
+// io61_submit(f, write, count)
+//    Hands the operation on the `count` slots in `f->async->run`, whose
+//    `iov` is filled in, to the helper thread.
+
+static void io61_submit(io61_file* f, bool write, size_t count) {
+    io61_async* a = f->async;
+    off_t first = write ? a->run[0]->lo : a->run[0]->off;
+    for (size_t i = 0; i != count; ++i) {
+        a->run[i]->busy = true;
+    }
+    a->busy = true;
+    a->write = write;
+    a->off = !f->seekable || first == f->fd_pos ? -1 : first;
+    a->count = count;
+    std::unique_lock<std::mutex> guard(a->m);
+    a->pending = true;
+    a->cv.notify_all();
+}
+
+// io61_wait(f)
+//    Waits for the operation in flight, if any, and collects its result.
+//    A failed write leaves its slots dirty, and a failed read leaves
+//    its slots unused; either way, the error recurs, and is reported,
+//    when the main thread retries. The helper's system calls join
+//    `f`'s statistics, but only time spent waiting here counts as
+//    blocked.
+
+static void io61_wait(io61_file* f) {
+    io61_async* a = f->async;
+    if (!a || !a->busy) {
+        return;
+    }
+    double start = bench61_now();
+    {
+        std::unique_lock<std::mutex> guard(a->m);
+        a->cv.wait(guard, [a] { return !a->pending; });
+    }
+    a->stats.blocked = bench61_now() - start;
+    io61_add_stats(&f->stats, a->stats);
+    a->stats = io61_statistics();
+    a->busy = false;
+    for (size_t i = 0; i != a->count; ++i) {
+        a->run[i]->busy = false;
+    }
+    if (a->off < 0 && a->result > 0) {
+        f->fd_pos += a->result;
+    }
+    if (a->write) {
+        io61_written(f, a->run, a->count, a->result);
+    } else {
+        io61_loaded(f, a->run, a->count, a->result, false);
+    }
+}
+
+// io61_prefetch(f, s)
+//    In async mode, starts reading the run of slots that follows the
+//    last fill, unless an operation is already in flight. The run length
+//    grows as in io61_fill. `s`, the slot about to be read, is kept.
+//    Waits while slots are dirty (read/write files), since replacing
+//    one would write.
+
+static void io61_prefetch(io61_file* f, io61_slot* s) {
+    io61_async* a = f->async;
+    off_t first = f->fill_hi;
+    if (!a || a->busy || f->cache->slots.size() < 2
+        || f->cache->ndirty != 0
+        || (f->regular && !f->fill_full)
+        || (f->seekable && first % f->bufsize != 0)) {
+        return;
+    }
+    size_t maxrun = std::min(f->cache->slots.size() / 2, io61_maxrun);
+    if (f->fill_full) {
+        f->ra = std::min((size_t) f->ra * 2, maxrun);
+    }
+    size_t count = f->ra;
+    for (size_t i = 0; f->seekable && i < count; ++i) {
+        if (io61_find(f, first + i * f->bufsize)) {
+            count = i;
+            break;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    s->busy = true;     // not really, but keeps `s` from being replaced
+    int r = io61_reserve(f, first, count, a->run);
+    assert(r == 0);     // no dirty slots to write
+    (void) r;
+    s->busy = false;
+    for (size_t i = 0; i != count; ++i) {
+        a->iov[i].iov_base = a->run[i]->data;
+        a->iov[i].iov_len = f->bufsize;
+    }
+    io61_submit(f, false, count);
+}
+
+// io61_write_behind(f)
+//    In async mode, once a quarter of the cache has been written
+//    sequentially in whole slots, starts writing those slots, oldest
+//    first and up to `io61_maxrun` of them, unless an operation is
+//    already in flight. Scattered writes are left for io61_flush_dirty,
+//    which can combine them. The window must be released.
+
+static void io61_write_behind(io61_file* f) {
+    io61_async* a = f->async;
+    size_t count = std::min((size_t) f->wb_run, io61_maxrun);
+    if (!a || a->busy
+        || count < std::min(std::max(f->cache->slots.size() / 4, (size_t) 1),
+                            io61_maxrun)) {
+        return;
+    }
+    off_t first = f->wb_next - (off_t) f->wb_run * f->bufsize;
+    for (size_t i = 0; i != count; ++i) {
+        io61_slot* s = io61_find(f, first + i * f->bufsize);
+        if (!s || s->busy || s->lo == s->hi || s->sparse
+            || s->lo != (i == 0 ? s->off : a->run[i - 1]->hi)
+            || (i == 0 && !f->seekable && s->lo != f->fd_pos)) {
+            f->wb_run = 0;  // already written, or rewritten since
+            return;
+        }
+        a->run[i] = s;
+        a->iov[i].iov_base = &s->data[s->lo - s->off];
+        a->iov[i].iov_len = s->hi - s->lo;
+    }
+    f->wb_run -= count;
+    io61_submit(f, true, count);
+}
+
+// io61_fill(f)
+//    Points the read cache window at data for file position `pos_tag`,
+//    reading it if necessary. Not called for write-only files. Returns 0
+//    on success (the window is empty only at end of file) and -1 on
+//    error.
+//
+//    Each miss reads a run of slots with one system call. While misses
+//    continue where the previous read ended, the run starts at one slot,
+//    as interactive pipes want, and doubles after every read that got all
+//    it asked for, up to 1 MiB (or half the cache). Regular files are
+//    also told to expect the next run (POSIX_FADV_WILLNEED). When misses
+//    walk backwards through the file (as in reverse61), the run instead
+//    ends at `pos_tag`, again doubling with each step. Any other miss
+//    resets the run to one slot.
+//
+//    In async mode, reaching a forward run also starts reading the next
+//    one in the background (io61_prefetch), so the caller consumes one
+//    run while the next is read, and sequential reads rarely block.
+
+static int io61_zfill(io61_file* f);
+
+int io61_fill(io61_file* f) {
+    io61_check_invariants(f);
+    if (f->z) {
+        return io61_zfill(f);
+    } else if (f->mapped) {
+        return 0;   // the mapping already holds the whole file
+    }
+
+    off_t pos = f->pos_tag;
+    io61_release(f);
+    off_t off = f->seekable ? pos - pos % f->bufsize : pos;
+    io61_slot* s = io61_find(f, off);
+    bool forward = false;
+    if (s && s->busy) {
+        // being prefetched: wait for it (it may turn out to be past end
+        // of file)
+        io61_wait(f);
+        s = io61_find(f, off);
+        forward = true;
+    }
+    if (s && pos < s->off + s->len) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+    }
+    if (s && pos >= s->off + s->len) {
+        // partial slot (end of file when it was read, or written by a
+        // write-only file sharing the cache): reread it
+        if (io61_reread(f, s) < 0) {
+            return -1;
+        }
+    } else if (!s) {
+        size_t maxrun = std::min(std::max(f->cache->slots.size() / 2,
+                                          (size_t) 1),
+                                 io61_maxrun);
+        size_t count;
+        off_t first = off;
+        if (off == f->fill_hi) {
+            forward = true;
+            f->back = 0;
+            if (f->fill_full) {
+                f->ra = std::min((size_t) f->ra * 2, maxrun);
+            }
+            count = f->ra;
+            for (size_t i = 1; f->seekable && i < count; ++i) {
+                if (io61_find(f, off + i * f->bufsize)) {
+                    count = i;
+                    break;
+                }
+            }
+        } else if (f->seekable && off + f->bufsize == f->fill_lo) {
+            f->ra = 1;
+            ++f->back;
+            count = std::min((size_t) 1 << std::min(f->back, 8U), maxrun);
+            count = std::min(count, (size_t) (off / f->bufsize + 1));
+            for (size_t i = 1; i < count; ++i) {
+                if (io61_find(f, off - i * f->bufsize)) {
+                    count = i;
+                    break;
+                }
+            }
+            first = off - (count - 1) * f->bufsize;
+        } else {
+            f->ra = 1;
+            f->back = 0;
+            count = 1;
+        }
+        if (io61_load(f, first, count) < 0) {
+            return -1;
+        }
+        if (f->regular && !f->async && !f->odirect
+            && off == first && f->fill_full
+            && count > 1) {
+            posix_fadvise(f->fd, f->fill_hi,
+                          std::min(count * 2, maxrun) * f->bufsize,
+                          POSIX_FADV_WILLNEED);
+        }
+        s = io61_find(f, off);
+    }
+    if (f->seekable && !(s && pos < s->off + s->len)) {
+        // short read: end of file, unless dirty slots extend the file
+        int r = io61_flush_eof(f);
+        if (r > 0) {
+            s = io61_find(f, off);
+            r = s ? io61_reread(f, s) : io61_load(f, off, 1);
+            s = io61_find(f, off);
+        }
+        if (r < 0) {
+            return -1;
+        }
+    }
+    if (s && pos < s->off + s->len) {
+        if (forward) {
+            io61_prefetch(f, s);
+        }
+        io61_set_window(f, s, pos);
+    }
+
+    // Recheck invariants (good practice!).
+    io61_check_invariants(f);
+    return 0;
+}
+
+
+// io61_try_map(f)
+//    Switches the read file `f` to mmap mode if it is a nonempty regular
+//    file. Pipes, sockets, and devices keep using cache slots. Setting
+//    the environment variable `IO61_MMAP=0`, or simulating storage
+//    (io61_faults), disables mmap mode.
+
+static void io61_try_map(io61_file* f) {
+    struct stat s;
+    const char* env = getenv("IO61_MMAP");
+    if ((env && strcmp(env, "0") == 0)
+        || io61_get_faults()
+        || fstat(f->fd, &s) != 0
+        || !S_ISREG(s.st_mode)
+        || s.st_size <= 0
+        || (off_t) (size_t) s.st_size != s.st_size) {
+        return;
+    }
+    void* p = mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    f->buf = f->map = (unsigned char*) p;
+    f->maplen = s.st_size;
+    f->mapped = true;
+    f->pos_tag = f->pos_tag < s.st_size ? f->pos_tag : s.st_size;
+    f->tag = 0;
+    f->end_tag = s.st_size;
+    f->run_start = f->pos_tag;
+    f->jumps = 0;
+    f->advice = MADV_SEQUENTIAL;
+    madvise(p, s.st_size, f->advice);
+}
+
+// io61_map_seek(f, pos)
+//    Seeks in mmap mode. Adapts the mapping's advice to the access
+//    pattern: several seeks in a row after short sequential runs switch
+//    to MADV_RANDOM (readahead would only waste I/O), and a long run
+//    switches back to MADV_SEQUENTIAL.
+
+static int io61_map_seek(io61_file* f, off_t pos) {
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (pos != f->pos_tag) {
+        off_t run = f->pos_tag - f->run_start;
+        if (run < 0 || run >= (1 << 20)) {
+            f->jumps = 0;
+        } else {
+            ++f->jumps;
+        }
+        int advice = f->advice;
+        if (f->jumps >= 4) {
+            advice = MADV_RANDOM;
+        } else if (f->jumps == 0) {
+            advice = MADV_SEQUENTIAL;
+        }
+        if (advice != f->advice) {
+            f->advice = advice;
+            madvise(f->buf, f->end_tag, advice);
+        }
+    }
+    // positions past end of file read as end of file
+    f->pos_tag = f->run_start = pos < f->end_tag ? pos : f->end_tag;
+    return 0;
+}
+
+
+// io61_pool
+//    Cache memory shared by all files. A closed file's cache is kept for
+//    the next file opened with the same cache size, so programs that open
+//    many files (like scattergather61) skip the allocation and the page
+//    faults of touching fresh memory. Caches in use plus caches kept stay
+//    within a budget, `IO61_BUDGET` bytes (default 256 MiB): kept caches
+//    are freed to make room, and then a file that still doesn't fit gets
+//    fewer slots (at least one). With `IO61_HUGEPAGES=1`, caches of 2 MiB
+//    or more are 2 MiB aligned and advised MADV_HUGEPAGE, so transparent
+//    huge pages can back them.
+
+struct io61_pool {
+    std::mutex m;
+    size_t budget = 256 << 20;
+    size_t used = 0;        // bytes in open files' caches and in `kept`
+    bool huge = false;
+    std::vector<std::pair<unsigned char*, size_t>> kept;
+};
+
+static constexpr size_t io61_hugepage = 2 << 20;
+
+static io61_pool* io61_get_pool() {
+    static io61_pool* pool = [] {
+        io61_pool* p = new io61_pool;
+        if (const char* env = getenv("IO61_BUDGET")) {
+            p->budget = strtoull(env, nullptr, 0);
+        }
+        const char* huge = getenv("IO61_HUGEPAGES");
+        p->huge = huge && strcmp(huge, "1") == 0;
+        return p;
+    }();
+    return pool;
+}
+
+
+// io61_alloc_cache(c, nslots)
+//    Gives cache `c` `nslots` slots, or fewer if the budget requires
+//    (at least one). Returns false if the memory cannot be allocated.
+
+static bool io61_alloc_cache(io61_cache* c, size_t nslots) {
+    constexpr size_t bufsize = io61_file::bufsize;
+    io61_pool* pool = io61_get_pool();
+    std::unique_lock<std::mutex> guard(pool->m);
+    auto size_of = [&] (size_t n) {
+        size_t sz = n * bufsize;
+        if (pool->huge && sz >= io61_hugepage) {
+            sz = (sz + io61_hugepage - 1) & ~(io61_hugepage - 1);
+        }
+        return sz;
+    };
+    size_t sz = size_of(nslots);
+    c->data = nullptr;
+    for (auto it = pool->kept.begin(); it != pool->kept.end(); ++it) {
+        if (it->second == sz) {
+            c->data = it->first;
+            pool->kept.erase(it);
+            break;
+        }
+    }
+    while (!c->data && pool->used + sz > pool->budget
+           && !pool->kept.empty()) {
+        free(pool->kept.back().first);
+        pool->used -= pool->kept.back().second;
+        pool->kept.pop_back();
+    }
+    if (!c->data && pool->used + sz > pool->budget) {
+        size_t left = pool->budget - std::min(pool->used, pool->budget);
+        nslots = std::max(left / bufsize, (size_t) 1);
+        sz = size_of(nslots);
+    }
+    if (!c->data) {
+        bool huge = pool->huge && sz >= io61_hugepage;
+        if (huge) {
+            c->data = (unsigned char*) aligned_alloc(io61_hugepage, sz);
+            if (c->data) {
+                madvise(c->data, sz, MADV_HUGEPAGE);
+            }
+        }
+        if (!c->data) {
+            c->data = (unsigned char*) aligned_alloc(bufsize, sz);
+        }
+        if (!c->data) {
+            return false;
+        }
+        pool->used += sz;
+    }
+    c->datasize = sz;
+    guard.unlock();
+
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * nslots) {
+        nbuckets *= 2;
+    }
+    c->slots.resize(nslots);
+    c->buckets.assign(nbuckets, -1);
+    for (size_t i = 0; i != nslots; ++i) {
+        c->slots[i].data = &c->data[i * bufsize];
+    }
+    return true;
+}
+
+
+// io61_free_cache(c, keep)
+//    Releases cache `c`'s memory: keeps it for reuse if `keep` and the
+//    budget allows, and otherwise frees it (or, if `!keep`, leaves
+//    freeing it to the caller).
+
+static void io61_free_cache(io61_cache* c, bool keep) {
+    if (!c->data) {
+        return;
+    }
+    io61_pool* pool = io61_get_pool();
+    std::unique_lock<std::mutex> guard(pool->m);
+    if (keep && pool->used <= pool->budget) {
+        pool->kept.emplace_back(c->data, c->datasize);
+    } else {
+        if (keep) {
+            free(c->data);
+        }
+        pool->used -= c->datasize;
+    }
+    c->data = nullptr;
+}
+
+
+// io61_caches
+//    The shareable caches of open files (see io61_cache).
+
+static std::vector<io61_cache*> io61_caches;
+
+
+// io61_nslots()
+//    Returns the number of cache slots files get: `IO61_SLOTS`
+//    (environment variable; default 512, which is 2 MiB).
+
+static size_t io61_nslots() {
+    const char* env = getenv("IO61_SLOTS");
+    size_t nslots = env ? strtoul(env, nullptr, 0) : 512;
+    return std::max(nslots, (size_t) 1);
+}
+
+
+// io61_share(f, c)
+//    Makes `f` use the shareable cache `c`. Unless `f` is in mmap mode
+//    too, files in mmap mode would miss its cached writes (or it theirs
+//    reads), so they switch to cache slots. Returns false, changing
+//    nothing, if those slots cannot be allocated.
+
+static bool io61_share(io61_file* f, io61_cache* c) {
+    if (!f->mapped && c->slots.empty()
+        && !io61_alloc_cache(c, io61_nslots())) {
+        return false;
+    }
+    for (auto g : c->files) {
+        if (g->mapped && !f->mapped) {
+            g->mapped = false;
+            io61_set_window(g, nullptr, g->pos_tag);
+        }
+    }
+    f->cache = c;
+    if (!f->mapped) {
+        f->buf = c->data;
+    }
+    c->files.push_back(f);
+    if (!c->writer && f->mode != O_RDONLY) {
+        c->writer = f;
+    }
+    return true;
+}
+
+
+// io61_registry
+//    The statistics io61_report prints at exit: a JSON line for each
+//    closed file, the files still open, and the totals of closed files.
+
+struct io61_registry {
+    std::vector<io61_file*> open;
+    std::string closed;
+    io61_statistics total;
+};
+
+static io61_registry* io61_files = nullptr;
+
+
+// io61_stats_json(st, fd, mode)
+//    Returns a JSON line (schema `io61_stats`) for the statistics `st` of
+//    file descriptor `fd` opened with `mode`, or of all files if
+//    `fd < 0`. Numeric fields come first, so check.pl's parser sees them
+//    before any strings.
+
+static std::string io61_stats_json(const io61_statistics& st, int fd,
+                                   int mode) {
+    char buf[400];
+    snprintf(buf, sizeof(buf),
+        "{\"syscalls\":%llu, \"bytes\":%llu, \"hits\":%llu, "
+        "\"misses\":%llu, \"seek_hits\":%llu, \"seek_misses\":%llu, "
+        "\"blocked\":%.6f, \"hist\":[",
+        st.syscalls, st.bytes, st.hits, st.misses, st.seek_hits,
+        st.seek_misses, st.blocked);
+    std::string s = buf;
+    for (int k = 0; k != 24; ++k) {
+        snprintf(buf, sizeof(buf), "%s%llu", k ? "," : "", st.hist[k]);
+        s += buf;
+    }
+    if (fd < 0) {
+        s += "], \"schema\":\"io61_stats\", \"file\":\"total\"}\n";
+    } else {
+        const char* m = mode == O_RDONLY ? "r" : (mode == O_WRONLY ? "w" : "rw");
+        snprintf(buf, sizeof(buf),
+                 "], \"schema\":\"io61_stats\", \"file\":\"fd %d\", "
+                 "\"mode\":\"%s\"}\n", fd, m);
+        s += buf;
+    }
+    return s;
+}
+
+
+// io61_report()
+//    Writes the statistics of every file io61 opened, then their totals,
+//    to the bench61 channel (file descriptor 100 or $BENCH61), if there
+//    is one. Registered with `atexit` when the first file is opened.
+
+static void io61_report() {
+    int fd = bench61_output_fd();
+    if (fd < 0) {
+        return;
+    }
+    std::string s = io61_files->closed;
+    io61_statistics total = io61_files->total;
+    for (auto f : io61_files->open) {
+        s += io61_stats_json(f->stats, f->fd, f->mode);
+        io61_add_stats(&total, f->stats);
+    }
+    s += io61_stats_json(total, -1, 0);
+    size_t pos = 0;
+    while (pos != s.size()) {
+        ssize_t nw = write(fd, s.data() + pos, s.size() - pos);
+        if (nw > 0) {
+            pos += nw;
+        } else if (nw == 0 || (errno != EINTR && errno != EAGAIN)) {
+            break;
+        }
+    }
+}
+
+
+// io61_lz_bound(n), io61_lz_compress(src, n, dst),
+// io61_lz_decompress(src, n, dst, cap)
+//    A small LZ77 codec in the style of LZ4's block format, so that
+//    compressed mode needs no library. Compressed data is a series of
+//    sequences: a token byte (literal count in the high nibble, match
+//    length minus 4 in the low nibble, 15 meaning more length bytes
+//    follow), the literals, and a 2-byte little-endian match offset.
+//    The last sequence has only literals. io61_lz_compress writes at
+//    most io61_lz_bound(n) bytes to `dst` and returns how many.
+//    io61_lz_decompress returns the number of bytes it wrote to `dst`,
+//    or -1 if `src` is malformed or would overrun `cap` bytes.
+
+static size_t io61_lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static inline uint32_t io61_load32(const unsigned char* p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+static unsigned char* io61_lz_length(unsigned char* op, size_t n) {
+    for (; n >= 255; n -= 255) {
+        *op++ = 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+static size_t io61_lz_compress(const unsigned char* src, size_t n,
+                               unsigned char* dst) {
+    constexpr int hashbits = 12;
+    uint32_t table[1 << hashbits] = {};
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src;
+    const unsigned char* end = src + n;
+    unsigned char* op = dst;
+    if (n >= 13) {
+        // matches start at least 12 bytes, and end at least 5 bytes,
+        // before the end
+        const unsigned char* mflimit = end - 12;
+        const unsigned char* matchlimit = end - 5;
+        unsigned misses = 0;
+        while (ip < mflimit) {
+            uint32_t seq = io61_load32(ip);
+            uint32_t h = (seq * 2654435761U) >> (32 - hashbits);
+            const unsigned char* ref = src + table[h];
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > 65535 || io61_load32(ref) != seq) {
+                // skip faster through data that doesn't compress
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            const unsigned char* mp = ip + 4;
+            const unsigned char* rp = ref + 4;
+            while (mp < matchlimit && *mp == *rp) {
+                ++mp;
+                ++rp;
+            }
+            size_t lit = ip - anchor, mlen = mp - ip - 4;
+            unsigned char* token = op++;
+            *token = (std::min(lit, (size_t) 15) << 4)
+                | std::min(mlen, (size_t) 15);
+            if (lit >= 15) {
+                op = io61_lz_length(op, lit - 15);
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = (ip - ref) & 0xFF;
+            *op++ = (ip - ref) >> 8;
+            if (mlen >= 15) {
+                op = io61_lz_length(op, mlen - 15);
+            }
+            ip = anchor = mp;
+        }
+    }
+    size_t lit = end - anchor;
+    *op++ = std::min(lit, (size_t) 15) << 4;
+    if (lit >= 15) {
+        op = io61_lz_length(op, lit - 15);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+static ssize_t io61_lz_decompress(const unsigned char* src, size_t n,
+                                  unsigned char* dst, size_t cap) {
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + n;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + cap;
+    auto length = [&] (size_t len) -> ssize_t {
+        unsigned char b = 255;
+        while (len >= 15 && b == 255) {
+            if (ip == iend) {
+                return -1;
+            }
+            b = *ip++;
+            len += b;
+        }
+        return len;
+    };
+    while (ip != iend) {
+        unsigned token = *ip++;
+        ssize_t lit = length(token >> 4);
+        if (lit < 0 || lit > iend - ip || lit > oend - op) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        ssize_t mlen = length(token & 15);
+        if (mlen < 0 || off == 0 || off > (size_t) (op - dst)
+            || mlen + 4 > oend - op) {
+            return -1;
+        }
+        mlen += 4;
+        const unsigned char* mp = op - off;
+        if ((ssize_t) off >= mlen) {
+            memcpy(op, mp, mlen);
+            op += mlen;
+        } else {
+            while (mlen-- > 0) {
+                *op++ = *mp++;
+            }
+        }
+    }
+    return op - dst;
+}
+
+
+// io61_zstream
+//    Compressed mode state (see io61_fdopen). A compressed file's window
+//    holds decompressed ("raw") data a frame at a time, and its raw bytes
+//    are numbered from 0; the compressed bytes go through `inner`, an
+//    ordinary io61_file on the same fd, and its cache.
+//
+//    A compressed stream is `io61_zmagic`, then frames, each an 8-byte
+//    header (little-endian raw length; stored length, with the high bit
+//    set if the data is stored uncompressed) and its data, then an end
+//    frame with raw length 0. Frames hold `io61_zframe` raw bytes
+//    (64 KiB), or fewer if a flush ended one early. After the end frame
+//    of a seekable file comes the frame index: the raw and file offsets
+//    of every frame and of the end frame (8 bytes each), their count,
+//    and `io61_zmagic`. Seeks read the index, if there is one, or
+//    otherwise hop from frame header to frame header.
+
+struct io61_zpos {
+    off_t raw;      // raw offset of a frame
+    off_t file;     // file offset of its header
+};
+
+struct io61_zstream {
+    io61_file* inner;
+    std::vector<io61_zpos> index;   // known frames, in order
+    bool complete = false;      // `index` ends at the end frame
+    bool tried_trailer = false; // looked for the index at end of file
+
+    // reading
+    std::vector<unsigned char> raw;     // current frame
+    std::vector<unsigned char> cbuf;    // its compressed data, if that
+                                        //   spanned `inner`'s window
+    off_t next_raw = 0;         // next frame in sequence (raw offset)
+    off_t next_file;            //   and its header's file offset
+    bool end = false;           // no frames follow `next_raw`
+
+    // writing: finished frames are compressed in batches, by
+    // `nthreads` threads (IO61_ZTHREADS), then written in order
+    unsigned nthreads = 1;
+    std::vector<std::vector<unsigned char>> frames;     // raw frames
+    std::vector<std::vector<unsigned char>> out;        // compressed
+    std::vector<size_t> lens;   // raw length, then compressed length
+    std::vector<size_t> outlens;
+    size_t nbatch = 0;          // finished frames in the batch
+    off_t batch_raw = 0;        // raw offset of the batch
+};
+
+static constexpr size_t io61_zframe = 64 << 10;
+static const unsigned char io61_zmagic[8] = {
+    'i', 'o', '6', '1', 'l', 'z', '\r', '\n'
+};
+
+static void io61_put_le(unsigned char* p, uint64_t x, int n) {
+    for (int i = 0; i != n; ++i) {
+        p[i] = x >> (8 * i);
+    }
+}
+
+static uint64_t io61_get_le(const unsigned char* p, int n) {
+    uint64_t x = 0;
+    for (int i = n - 1; i >= 0; --i) {
+        x = (x << 8) | p[i];
+    }
+    return x;
+}
+
+
+// io61_zheader(z, pos, rawlen, stored, plain)
+//    Reads the frame header at file offset `pos` of `z->inner`, leaving
+//    the file positioned at the frame's data. Returns 1 for a frame, 0 at
+//    the end of the stream (an end frame, or end of file if the writer
+//    never finished), and -1 on error.
+
+static int io61_zheader(io61_zstream* z, off_t pos, size_t* rawlen,
+                        size_t* stored, bool* plain) {
+    io61_file* in = z->inner;
+    if (in->pos_tag != pos && io61_seek(in, pos) < 0) {
+        return -1;
+    }
+    unsigned char hdr[8];
+    ssize_t n = io61_read(in, hdr, 8);
+    if (n == 0) {
+        return 0;
+    } else if (n != 8) {
+        errno = n < 0 ? errno : EIO;
+        return -1;
+    }
+    *rawlen = io61_get_le(hdr, 4);
+    uint32_t word = io61_get_le(hdr + 4, 4);
+    *stored = word & 0x7FFFFFFF;
+    *plain = word >> 31;
+    if (*rawlen > io61_zframe
+        || *stored > io61_lz_bound(io61_zframe)
+        || (*plain && *stored != *rawlen)) {
+        errno = EIO;
+        return -1;
+    }
+    return *rawlen != 0;
+}
+
+
+// io61_zload_index(f)
+//    Reads the frame index at the end of compressed file `f`, if it has
+//    one.
+
+static void io61_zload_index(io61_file* f) {
+    io61_zstream* z = f->z;
+    io61_file* in = z->inner;
+    z->tried_trailer = true;
+    off_t size = io61_filesize(in);
+    off_t base = z->index[0].file;
+    unsigned char t[16];
+    if (size < base + 16 + 16
+        || io61_seek(in, size - 16) < 0
+        || io61_read(in, t, 16) != 16
+        || memcmp(t + 8, io61_zmagic, 8) != 0) {
+        return;
+    }
+    uint64_t count = io61_get_le(t, 8);
+    if (count == 0 || count > (uint64_t) (size - 16 - base) / 16) {
+        return;
+    }
+    std::vector<unsigned char> buf(count * 16);
+    if (io61_seek(in, size - 16 - count * 16) < 0
+        || io61_read(in, buf.data(), buf.size()) != (ssize_t) buf.size()) {
+        return;
+    }
+    std::vector<io61_zpos> index(count);
+    for (size_t i = 0; i != count; ++i) {
+        index[i].raw = io61_get_le(&buf[i * 16], 8);
+        index[i].file = io61_get_le(&buf[i * 16 + 8], 8);
+        if (i == 0 ? index[i].raw != 0 || index[i].file != base
+            : index[i].raw <= index[i - 1].raw
+              || index[i].file <= index[i - 1].file) {
+            return;
+        }
+    }
+    z->index = std::move(index);
+    z->complete = true;
+}
+
+
+// io61_zlocate(f, pos)
+//    Makes the frame holding raw offset `pos` of compressed file `f` the
+//    next to read. Returns 0 on success, 1 if `pos` is at or past the end
+//    of the stream, and -1 on error.
+
+static int io61_zlocate(io61_file* f, off_t pos) {
+    io61_zstream* z = f->z;
+    if (!z->complete && !z->tried_trailer && z->inner->seekable) {
+        io61_zload_index(f);
+    }
+    while (!z->complete && z->index.back().raw <= pos) {
+        io61_zpos p = z->index.back();
+        size_t rawlen, stored;
+        bool plain;
+        int r = io61_zheader(z, p.file, &rawlen, &stored, &plain);
+        if (r < 0) {
+            return -1;
+        } else if (r == 0) {
+            z->complete = true;
+        } else {
+            z->index.push_back({p.raw + (off_t) rawlen,
+                                p.file + 8 + (off_t) stored});
+        }
+    }
+    auto it = std::upper_bound(z->index.begin(), z->index.end(), pos,
+                               [] (off_t x, const io61_zpos& p) {
+                                   return x < p.raw;
+                               });
+    --it;
+    if (z->complete && it + 1 == z->index.end()) {
+        return 1;
+    }
+    z->next_raw = it->raw;
+    z->next_file = it->file;
+    z->end = false;
+    return 0;
+}
+
+
+// io61_zfill(f)
+//    io61_fill for compressed files: decompresses the frame holding
+//    `pos_tag` into the window. Sequential reads take the next frame;
+//    others find theirs with io61_zlocate.
+
+static int io61_zfill(io61_file* f) {
+    io61_zstream* z = f->z;
+    io61_file* in = z->inner;
+    off_t pos = f->pos_tag;
+    f->tag = f->end_tag = pos;
+    if (pos != z->next_raw) {
+        int r = io61_zlocate(f, pos);
+        if (r != 0) {
+            return r < 0 ? -1 : 0;
+        }
+    } else if (z->end) {
+        return 0;
+    }
+
+    size_t rawlen, stored;
+    bool plain;
+    int r = io61_zheader(z, z->next_file, &rawlen, &stored, &plain);
+    if (r <= 0) {
+        z->end = r == 0;
+        if (r == 0 && !z->complete) {
+            z->index.push_back({z->next_raw, z->next_file});
+            z->complete = true;
+        }
+        return r;
+    }
+    if (!z->complete && z->next_raw > z->index.back().raw) {
+        z->index.push_back({z->next_raw, z->next_file});
+    }
+    const unsigned char* src;
+    if ((size_t) (in->end_tag - in->pos_tag) >= stored) {
+        // decompress straight from `inner`'s window
+        src = &in->buf[in->pos_tag - in->tag];
+        in->pos_tag += stored;
+    } else {
+        z->cbuf.resize(stored);
+        ssize_t n = io61_read(in, z->cbuf.data(), stored);
+        if (n != (ssize_t) stored) {
+            errno = n < 0 ? errno : EIO;
+            return -1;
+        }
+        src = z->cbuf.data();
+    }
+    if (plain) {
+        memcpy(z->raw.data(), src, rawlen);
+    } else if (io61_lz_decompress(src, stored, z->raw.data(), rawlen)
+               != (ssize_t) rawlen) {
+        errno = EIO;
+        return -1;
+    }
+    f->buf = z->raw.data();
+    f->tag = z->next_raw;
+    f->end_tag = z->next_raw + rawlen;
+    f->pos_tag = pos;
+    z->next_raw += rawlen;
+    z->next_file += 8 + stored;
+    if (pos >= f->end_tag) {
+        // `pos` lies past the end of a stream that lacked an end frame
+        f->tag = f->end_tag = pos;
+    }
+    return 0;
+}
+
+
+// io61_zwrite_batch(f)
+//    Compresses the finished frames of compressed file `f`, in parallel
+//    if it has several threads, and writes them to `inner`. Returns 0 on
+//    success and -1 on error.
+
+static int io61_zwrite_batch(io61_file* f) {
+    io61_zstream* z = f->z;
+    auto compress = [z] (size_t first) {
+        for (size_t k = first; k < z->nbatch; k += z->nthreads) {
+            unsigned char* o = z->out[k].data();
+            size_t len = z->lens[k];
+            size_t clen = io61_lz_compress(z->frames[k].data(), len, o + 8);
+            bool plain = clen >= len;
+            if (plain) {
+                memcpy(o + 8, z->frames[k].data(), len);
+                clen = len;
+            }
+            io61_put_le(o, len, 4);
+            io61_put_le(o + 4, clen | (plain ? 0x80000000U : 0), 4);
+            z->outlens[k] = clen + 8;
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (size_t t = 1; t < std::min((size_t) z->nthreads, z->nbatch); ++t) {
+        helpers.emplace_back(compress, t);
+    }
+    compress(0);
+    for (auto& h : helpers) {
+        h.join();
+    }
+
+    io61_file* in = z->inner;
+    off_t raw = z->batch_raw;
+    for (size_t k = 0; k != z->nbatch; ++k) {
+        z->index.push_back({raw, in->pos_tag});
+        raw += z->lens[k];
+        ssize_t n = io61_write(in, z->out[k].data(), z->outlens[k]);
+        if (n != (ssize_t) z->outlens[k]) {
+            z->nbatch = 0;  // the rest of the batch is lost
+            return -1;
+        }
+    }
+    z->batch_raw = raw;
+    z->nbatch = 0;
+    return 0;
+}
+
+
+// io61_zend_frame(f, flush)
+//    Finishes the frame in compressed file `f`'s write window, writes
+//    the batch if it is full (or if `flush`), and opens a window on the
+//    next frame. Returns 0 on success and -1 on error.
+
+static int io61_zend_frame(io61_file* f, bool flush) {
+    io61_zstream* z = f->z;
+    if (f->end_tag != f->tag) {
+        z->lens[z->nbatch] = f->end_tag - f->tag;
+        ++z->nbatch;
+    }
+    int r = 0;
+    if (z->nbatch == z->frames.size() || (flush && z->nbatch != 0)) {
+        r = io61_zwrite_batch(f);
+    }
+    f->buf = z->frames[z->nbatch].data();
+    f->tag = f->wstart = f->end_tag;
+    f->wend_tag = f->tag + io61_zframe;
+    return r;
+}
+
+
+// io61_zopen(in)
+//    Returns a compressed file reading or writing through `in`, or `in`
+//    itself if it is a read file that isn't compressed.
+
+static io61_file* io61_zopen(io61_file* in) {
+    unsigned char magic[8];
+    if (in->mode == O_RDONLY) {
+        // peek at the first bytes
+        if (in->seekable) {
+            off_t pos = in->pos_tag;
+            if (io61_read(in, magic, 8) != 8
+                || memcmp(magic, io61_zmagic, 8) != 0) {
+                io61_seek(in, pos);
+                return in;
+            }
+        } else if (io61_fill(in) < 0
+                   || in->end_tag - in->pos_tag < 8
+                   || memcmp(&in->buf[in->pos_tag - in->tag],
+                             io61_zmagic, 8) != 0) {
+            return in;
+        } else {
+            in->pos_tag += 8;
+        }
+    } else if (io61_write(in, io61_zmagic, 8) != 8) {
+        return in;
+    }
+
+    io61_file* f = new io61_file;
+    f->fd = in->fd;
+    f->mode = in->mode;
+    f->seekable = in->seekable;
+    f->regular = in->regular;
+    f->fd_pos = 0;
+    f->cache = new io61_cache;  // empty: `inner` does the caching
+    f->cache->buckets.assign(1, -1);
+    f->cache->files.push_back(f);
+    io61_zstream* z = f->z = new io61_zstream;
+    z->inner = in;
+    z->next_file = in->pos_tag;
+    z->index.push_back({0, in->pos_tag});
+    f->tag = f->end_tag = f->pos_tag = 0;
+    if (f->mode == O_RDONLY) {
+        z->raw.resize(io61_zframe);
+        f->buf = z->raw.data();
+        return f;
+    }
+    z->index.clear();   // the writer lists frames as it writes them
+    if (const char* env = getenv("IO61_ZTHREADS")) {
+        z->nthreads = std::max(strtoul(env, nullptr, 0), 1UL);
+    }
+    // a batch gives each thread several frames, to pay for starting it
+    size_t nframes = z->nthreads == 1 ? 1 : 4 * z->nthreads;
+    z->frames.resize(nframes);
+    for (auto& fr : z->frames) {
+        fr.resize(io61_zframe);
+    }
+    z->out.resize(nframes);
+    for (auto& o : z->out) {
+        o.resize(8 + io61_lz_bound(io61_zframe));
+    }
+    z->lens.resize(nframes);
+    z->outlens.resize(nframes);
+    io61_zend_frame(f, false);
+    return f;
+}
+
+
+// io61_zseek(f, pos), io61_zflush(f), io61_zfilesize(f)
+//    io61_seek, io61_flush, and io61_filesize for compressed files. Seeks
+//    in seekable read files are free until the next read finds the
+//    frame; write files can't seek. A flush ends the current frame.
+//    The size is the raw size, which is known only for seekable read
+//    files.
+
+static int io61_zseek(io61_file* f, off_t pos) {
+    if (pos >= f->tag && pos <= f->end_tag
+        && (f->mode == O_RDONLY || pos == f->pos_tag)) {
+        f->pos_tag = pos;
+        return 0;
+    } else if (f->mode != O_RDONLY || !f->seekable || pos < 0) {
+        errno = pos < 0 ? EINVAL : ESPIPE;
+        return -1;
+    }
+    f->tag = f->end_tag = f->pos_tag = pos;
+    return 0;
+}
+
+static int io61_zflush(io61_file* f) {
+    if (f->mode == O_RDONLY) {
+        return 0;
+    } else if (io61_zend_frame(f, true) < 0) {
+        return -1;
+    }
+    return io61_flush(f->z->inner);
+}
+
+static off_t io61_zfilesize(io61_file* f) {
+    if (f->mode != O_RDONLY || !f->seekable
+        || io61_zlocate(f, (off_t) LLONG_MAX) < 0) {
+        return -1;
+    }
+    return f->z->index.back().raw;
+}
+
+
+// io61_zclose(f)
+//    io61_close for compressed files: writes any frames left, the end
+//    frame, and (if seekable) the frame index, then closes `inner`.
+
+static int io61_zclose(io61_file* f) {
+    io61_zstream* z = f->z;
+    io61_file* in = z->inner;
+    int r = 0;
+    if (f->mode != O_RDONLY) {
+        unsigned char hdr[16] = {};
+        r = io61_zend_frame(f, true);
+        z->index.push_back({f->end_tag, in->pos_tag});
+        if (io61_write(in, hdr, 8) != 8) {
+            r = -1;
+        }
+        if (in->seekable) {
+            for (auto& p : z->index) {
+                io61_put_le(hdr, p.raw, 8);
+                io61_put_le(hdr + 8, p.file, 8);
+                if (io61_write(in, hdr, 16) != 16) {
+                    r = -1;
+                }
+            }
+            io61_put_le(hdr, z->index.size(), 8);
+            memcpy(hdr + 8, io61_zmagic, 8);
+            if (io61_write(in, hdr, 16) != 16) {
+                r = -1;
+            }
+        }
+    }
+    if (io61_close(in) < 0) {
+        r = -1;
+    }
+    delete z;
+    delete f->cache;
+    delete f;
+    return r;
+}
+
+
+// io61_open_failed(f)
+//    Undoes a partly opened `f` whose cache could not be allocated.
+//    Leaves `f->fd` open. Returns nullptr with `errno` set to ENOMEM.
+
+static io61_file* io61_open_failed(io61_file* f) {
+    auto& open = io61_files->open;
+    open.erase(std::find(open.begin(), open.end(), f));
+    if (f->map) {
+        munmap(f->map, f->maplen);
+    }
+    if (io61_cache* c = f->cache) {
+        auto it = std::find(io61_caches.begin(), io61_caches.end(), c);
+        if (it != io61_caches.end()) {
+            io61_caches.erase(it);
+        }
+        delete c;
+    }
+    delete f;
+    errno = ENOMEM;
+    return nullptr;
+}
+
 
-int io61_fill(io61_file* f) {
-    // Fill the read cache with new data, starting from file offset `end_tag`.
-    // Only called for read caches.
+// io61_open_fd(fd, mode)
+//    Returns a new io61_file for `fd`, as io61_fdopen does, but never in
+//    compressed mode.
 
-    // Check invariants
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
+static io61_file* io61_open_fd(int fd, int mode) {
+    assert(fd >= 0);
+    io61_file* f = new io61_file;
+    f->fd = fd;
+    f->mode = mode & O_ACCMODE;
+    if (!io61_files) {
+        io61_files = new io61_registry;
+        atexit(io61_report);
     }
+    io61_files->open.push_back(f);
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    f->seekable = off >= 0;
+    assert(f->seekable || f->mode != O_RDWR);
+    f->fd_pos = off >= 0 ? off : 0;
+    f->tag = f->end_tag = f->pos_tag = f->fd_pos;
+    struct stat st;
+    f->regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    const char* odirect = getenv("IO61_DIRECT");
+    int fl = fcntl(fd, F_GETFL);
+    if (f->regular && fl >= 0 && !(fl & O_DIRECT)
+        && odirect && strcmp(odirect, "1") == 0) {
+        f->odirect = fcntl(fd, F_SETFL, fl | O_DIRECT) == 0;
+    } else {
+        f->odirect = fl >= 0 && (fl & O_DIRECT);
+    }
+    const char* async = getenv("IO61_ASYNC");
+    bool want_async = async && strcmp(async, "1") == 0;
 
-    // Reset the cache to empty.
-    f->tag = f->pos_tag = f->end_tag;
-    // Read data.
-    ssize_t n = read(f->fd, f->cbuf, f->bufsize);
-    if (n >= 0) {
-        f->end_tag = f->tag + n;
-    } 
-    else {
-        return -1;
+    io61_cache* c = nullptr;
+    bool shareable = f->regular && !f->odirect && !want_async;
+    if (shareable) {
+        for (auto x : io61_caches) {
+            if (x->dev == st.st_dev && x->ino == st.st_ino) {
+                c = x;
+            }
+        }
+    }
+    if (f->mode == O_RDONLY && !f->odirect
+        && (!c || std::all_of(c->files.begin(), c->files.end(),
+                              [] (io61_file* g) { return g->mapped; }))) {
+        io61_try_map(f);
+    }
+    if (c) {
+        return io61_share(f, c) ? f : io61_open_failed(f);
     }
 
-    // Recheck invariants (good practice!).
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
+    c = f->cache = new io61_cache;
+    c->files.push_back(f);
+    if (f->mode != O_RDONLY) {
+        c->writer = f;
+    }
+    if (shareable) {
+        c->shareable = true;
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        io61_caches.push_back(c);
+    }
+    if (f->mapped) {
+        return f;
     }
 
-    return 0;
+    if (!io61_alloc_cache(c, f->seekable || f->mode == O_RDONLY
+                             || want_async ? io61_nslots() : 1)) {
+        return io61_open_failed(f);
+    }
+    if (want_async) {
+        f->async = new io61_async;
+        f->async->fd = fd;
+        f->async->thread = std::thread(io61_async_main, f->async);
+    }
+    f->buf = c->data;
+    return f;
 }
 
+
 // io61_fdopen(fd, mode)
-//    Returns a new io61_file for file descriptor `fd`. `mode` is either
-//    O_RDONLY for a read-only file or O_WRONLY for a write-only file.
-//    You need not support read/write files.
+//    Returns a new io61_file for file descriptor `fd`. `mode` is
+//    O_RDONLY for a read-only file, O_WRONLY for a write-only file, or
+//    O_RDWR for a read/write file, which must be seekable. Returns
+//    nullptr, with `errno` set to ENOMEM, if the file's cache cannot be
+//    allocated; `fd` stays open.
+//
+//    Seekable files, and unseekable files opened for reading, get
+//    `IO61_SLOTS` cache slots (environment variable; default 512, which
+//    is 2 MiB), or fewer if the global cache budget is exhausted (see
+//    io61_pool). Fresh slot memory is only touched as it is used. A
+//    regular file already open in this process shares that file's cache
+//    (see io61_cache), so the two see each other's cached writes; only
+//    read-only files opened alongside other mmap mode files use mmap
+//    mode. Sharing assumes the files are used from one thread.
+//
+//    Setting `IO61_ASYNC=1` selects async mode for files that are not
+//    mapped: a helper thread per file reads ahead and writes behind
+//    while the caller works on other slots. (io_uring would avoid the
+//    thread, but needs liburing to be usable.) Unseekable files written
+//    in async mode also get `IO61_SLOTS` slots, so there is something to
+//    write behind.
+//
+//    Setting `IO61_DIRECT=1` opens regular files with O_DIRECT, so large
+//    copies don't pass through (and evict) the page cache; an fd already
+//    opened with O_DIRECT gets the same treatment. The slot cache then
+//    acts as the aligned bounce buffer: reads and writes that skip the
+//    cache, and mmap mode, are turned off. A filesystem that refuses
+//    O_DIRECT gets ordinary buffered I/O.
+//
+//    Setting `IO61_COMPRESS` selects compressed mode (see io61_zstream):
+//    with `w` or `1`, write-only files are compressed as they are
+//    written; with `r` or `1`, read-only files that start out compressed
+//    are decompressed as they are read. (Compressed files are read and
+//    written sequentially; only seekable read files can seek, and files
+//    must be blocking.) With `IO61_ZTHREADS=N`, N threads compress
+//    batches of frames in parallel.
 
 io61_file* io61_fdopen(int fd, int mode) {
-    assert(fd >= 0);
-    io61_file* f = new io61_file;
-    f->fd = fd;
-    f->mode = mode;
+    io61_file* f = io61_open_fd(fd, mode);
+    const char* env = getenv("IO61_COMPRESS");
+    if (f && env
+        && ((f->mode == O_RDONLY && strpbrk(env, "r1"))
+            || (f->mode == O_WRONLY && strpbrk(env, "w1")))) {
+        f = io61_zopen(f);
+    }
     return f;
 }
 
 
 // io61_close(f)
-//    Closes the io61_file `f` and releases all its resources.
+//    Closes the io61_file `f` and releases all its resources. Cached
+//    writes to a nonblocking file are flushed even if that must wait.
+//    The file's statistics are kept for io61_report.
+//
+//    A prefetch still in flight might never finish (say, on a terminal),
+//    so rather than waiting for it, the helper thread is left to close
+//    `fd` and free the slots itself.
 
 int io61_close(io61_file* f) {
-    io61_flush(f);
-    int r = close(f->fd);
+    if (f->z) {
+        return io61_zclose(f);
+    }
+    while (io61_flush(f) < 0 && errno == EAGAIN) {
+        pollfd pfd = {f->fd, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+    }
+    auto& open = io61_files->open;
+    open.erase(std::find(open.begin(), open.end(), f));
+    io61_files->closed += io61_stats_json(f->stats, f->fd, f->mode);
+    io61_add_stats(&io61_files->total, f->stats);
+    if (f->map) {
+        munmap(f->map, f->maplen);
+    }
+    io61_cache* c = f->cache;
+    c->files.erase(std::find(c->files.begin(), c->files.end(), f));
+    if (c->writer == f) {
+        c->writer = nullptr;
+        for (auto g : c->files) {
+            if (g->mode != O_RDONLY) {
+                c->writer = g;
+            }
+        }
+    }
+    if (!c->writer) {
+        // no file left can write the dirty slots (if any: the flush above
+        // failed), so drop the dirty bytes
+        for (auto& s : c->slots) {
+            s.lo = s.hi;
+            s.sparse = false;
+        }
+        c->ndirty = 0;
+    }
+    bool orphan = false;
+    if (io61_async* a = f->async) {
+        std::unique_lock<std::mutex> guard(a->m);
+        a->stop = true;
+        a->orphan = orphan = a->pending;
+        if (orphan) {
+            a->data = c->data;
+            io61_free_cache(c, false);
+            a->thread.detach();
+        }
+        a->cv.notify_all();
+        guard.unlock();
+        if (!orphan) {
+            a->thread.join();
+            delete a;
+        }
+    }
+    int r = orphan ? 0 : close(f->fd);
+    if (f->relay[0] >= 0) {
+        close(f->relay[0]);
+        close(f->relay[1]);
+    }
+    if (c->files.empty()) {
+        if (c->shareable) {
+            io61_caches.erase(std::find(io61_caches.begin(),
+                                        io61_caches.end(), c));
+        }
+        io61_free_cache(c, true);
+        delete c;
+    }
     delete f;
     return r;
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
-//    which equals -1, on end of file or error.
+//    which equals -1, on end of file or error. io61_readc (io61.hh)
+//    calls this when the window is used up.
 
-int io61_readc(io61_file* f) {
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
-    }
-    unsigned char buf[1];
+int io61_readc_slow(io61_file* f) {
+    io61_check_invariants(f);
     if (f->pos_tag == f->end_tag) {
-        int r = io61_fill(f);
-        if (r < 0) {
-            return -1;
-        }
-        if (f->pos_tag == f->end_tag) {
+        if (io61_fill(f) < 0 || f->pos_tag == f->end_tag) {
             return -1;
         }
     }
-    buf[0] = f->cbuf[f->pos_tag - f->tag];
-    f->pos_tag++;
-    return buf[0];
+    unsigned char ch = f->buf[f->pos_tag - f->tag];
+    ++f->pos_tag;
+    return ch;
+}
+
+
+// io61_read_direct(f, sz)
+//    Returns true if a read of `sz` bytes should skip the cache.
+
+static bool io61_read_direct(io61_file* f, size_t sz) {
+    return f->pos_tag == f->end_tag
+        && !f->z
+        && sz >= io61_direct_min
+        && !f->mapped
+        && !f->odirect
+        && f->mode == O_RDONLY
+        && !io61_shared(f)
+        && !io61_find(f, f->seekable
+                         ? f->pos_tag - f->pos_tag % f->bufsize
+                         : f->pos_tag);
 }
 
 
@@ -112,21 +2504,67 @@ int io61_readc(io61_file* f) {
 //    Note that the return value might be positive, but less than `sz`,
 //    if end-of-file or error is encountered before all `sz` bytes are read.
 //    This is called a “short read.”
-
+//
+//    Requests of at least `io61_direct_min` bytes that miss the cache
+//    are read directly into `buf`, skipping the cache and its extra copy.
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
-    // Check invariants.
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
+    io61_check_invariants(f);
+
+    size_t pos = 0;
+    while (pos < sz) {
+        if (io61_read_direct(f, sz - pos)) {
+            ++f->stats.misses;
+            iovec iov = {&buf[pos], sz - pos};
+            ssize_t n = io61_read_at(f, &iov, 1, f->pos_tag);
+            if (n > 0) {
+                io61_set_window(f, nullptr, f->pos_tag + n);
+                pos += n;
+                continue;
+            } else if (n == 0) {
+                break;
+            } else {
+                return pos ? (ssize_t) pos : -1;
+            }
+        }
+        if (f->pos_tag == f->end_tag) {
+            if (io61_fill(f) < 0) {
+                return pos ? (ssize_t) pos : -1;
+            }
+            if (f->pos_tag == f->end_tag) {
+                break;
+            }
+        }
+        size_t ch = sz - pos;
+        if (ch > (size_t) (f->end_tag - f->pos_tag)) {
+            ch = (size_t) (f->end_tag - f->pos_tag);
+        }
+        memcpy(&buf[pos], &f->buf[f->pos_tag - f->tag], ch);
+        f->pos_tag += ch;
+        pos += ch;
     }
+    return pos;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Reads bytes from `f` into `buf` up to and including the next
+//    newline, but at most `sz` bytes. Returns like io61_read: the number
+//    of bytes read, 0 at end of file, or -1 on error before any bytes
+//    were read. The result ends in a newline unless the line was longer
+//    than `sz` or was the last line of the file.
+//
+//    Each cache window is searched with one `memchr` call (which the C
+//    library vectorizes) rather than one io61_readc call per byte.
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz) {
+    io61_check_invariants(f);
 
     size_t pos = 0;
     while (pos < sz) {
         if (f->pos_tag == f->end_tag) {
-            int r = io61_fill(f);
-            if (r < 0) {
-                return -1;
+            if (io61_fill(f) < 0) {
+                return pos ? (ssize_t) pos : -1;
             }
             if (f->pos_tag == f->end_tag) {
                 break;
@@ -136,40 +2574,126 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
         if (ch > (size_t) (f->end_tag - f->pos_tag)) {
             ch = (size_t) (f->end_tag - f->pos_tag);
         }
-        memcpy(&buf[pos], &f->cbuf[f->pos_tag - f->tag], ch);
+        const unsigned char* p = &f->buf[f->pos_tag - f->tag];
+        auto nl = (const unsigned char*) memchr(p, '\n', ch);
+        if (nl) {
+            ch = nl + 1 - p;
+        }
+        memcpy(&buf[pos], p, ch);
         f->pos_tag += ch;
         pos += ch;
+        if (nl) {
+            break;
+        }
     }
     return pos;
 }
 
-// io61_writec(f)
-//    Write a single character `ch` to `f`. Returns 0 on success and
-//    -1 on error.
 
+// io61_peekline(f, ptr, len)
+//    Reads the next line of `f`, including its newline if any, without
+//    copying it out. On success sets `*ptr` and `*len` to the line and
+//    returns 0; the line stays valid until the next call on `f`. Returns
+//    EOF (-1) at end of file or on error.
+//
+//    A line that lies within the cache window (for mapped files, any
+//    line) is returned in place. A line that spans windows is gathered
+//    into `f->line`. If a nonblocking file has no more data mid-line,
+//    returns -1 with `errno == EAGAIN` and resumes the line next time.
 
-int io61_writec(io61_file* f, int ch) {
-    unsigned char buf[1];
-    buf[0] = ch;
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
+int io61_peekline(io61_file* f, const unsigned char** ptr, size_t* len) {
+    io61_check_invariants(f);
+    const unsigned char* nl = nullptr;
+    if (!f->line_held) {
+        if (f->pos_tag == f->end_tag
+            && (io61_fill(f) < 0 || f->pos_tag == f->end_tag)) {
+            return -1;
+        }
+
+        const unsigned char* p = &f->buf[f->pos_tag - f->tag];
+        size_t n = f->end_tag - f->pos_tag;
+        nl = (const unsigned char*) memchr(p, '\n', n);
+        if (nl) {
+            *ptr = p;
+            *len = nl + 1 - p;
+            f->pos_tag += *len;
+            return 0;
+        }
+
+        f->line.assign(p, p + n);
+        f->pos_tag += n;
+    }
+    int r = 0;
+    while (!nl
+           && (r = io61_fill(f)) >= 0
+           && f->pos_tag != f->end_tag) {
+        const unsigned char* p = &f->buf[f->pos_tag - f->tag];
+        size_t n = f->end_tag - f->pos_tag;
+        nl = (const unsigned char*) memchr(p, '\n', n);
+        if (nl) {
+            n = nl + 1 - p;
+        }
+        f->line.insert(f->line.end(), p, p + n);
+        f->pos_tag += n;
     }
-    // Write cache invariant.
-    if (f->pos_tag != f->end_tag) {
+    // a nonblocking file that runs dry mid-line keeps the partial line
+    // for the next call
+    f->line_held = !nl && r < 0 && errno == EAGAIN;
+    if (f->line_held) {
         return -1;
     }
+    *ptr = f->line.data();
+    *len = f->line.size();
+    return 0;
+}
+
+
+// io61_writec_slow(f, ch)
+//    Write a single character `ch` to `f`. Returns 0 on success and
+//    -1 on error. io61_writec (io61.hh) calls this when the window is
+//    full or closed.
+
+int io61_writec_slow(io61_file* f, int ch) {
+    io61_check_invariants(f);
+    unsigned char c = ch;
+    return io61_write(f, &c, 1) == 1 ? 0 : -1;
+}
+
+// io61_open_window(f)
+//    Opens a write window on the slot for file position `pos_tag`. Bytes
+//    written need not touch the slot's dirty range; io61_release tracks
+//    scattered writes in the slot's dirty bitmap. A read/write file
+//    reads the slot first if it isn't cached (or was cached by a
+//    write-only file); bytes skipped past its end of file read as zeros.
+//    Returns 0 on success and -1 on error.
 
-    if (f->end_tag == f->tag + f->bufsize) {
-        int r = io61_flush(f);
-        if (r < 0){
+static int io61_open_window(io61_file* f) {
+    off_t pos = f->pos_tag;
+    io61_release(f);
+    io61_write_behind(f);
+    off_t off = pos - pos % f->bufsize;
+    io61_slot* s = io61_find(f, off);
+    if (s && s->busy) {
+        io61_wait(f);
+    }
+    ++(s ? f->stats.hits : f->stats.misses);
+    if (!s && f->mode == O_RDWR) {
+        if (io61_load(f, off, 1) < 0) {
             return -1;
         }
+        s = io61_find(f, off);
     }
-
-    f->cbuf[f->pos_tag - f->tag] = buf[0];
-    f->pos_tag++;
-    f->end_tag++;
+    if (!s && !(s = io61_replace(f, off))) {
+        return -1;
+    }
+    if (f->mode == O_RDWR && pos > off + s->len && !s->whole
+        && io61_reread(f, s) < 0) {
+        return -1;
+    }
+    if (f->mode == O_RDWR && pos > off + s->len) {
+        memset(&s->data[s->len], 0, pos - off - s->len);
+    }
+    io61_set_window(f, s, pos, true);
     return 0;
 }
 
@@ -179,36 +2703,120 @@ int io61_writec(io61_file* f, int ch) {
 //    a drive running out of space. In this case io61_write returns the
 //    number of characters written, or -1 if no characters were written
 //    before the error occurred.
-
+//
+//    When no slot is dirty, writes of at least `io61_direct_min` bytes go
+//    directly from `buf` to the file.
 
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
-    // Check invariants.
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
-    }
-    // Write cache invariant.
-    if (f->pos_tag != f->end_tag) {
-        return -1;
-    }
+    io61_check_invariants(f);
 
     size_t pos = 0;
     while (pos < sz) {
-        if (f->end_tag == f->tag + f->bufsize) {
-            int r = io61_flush(f);
-            if (r < 0){
-                return -1;
+        if (f->end_tag < f->wend_tag) {
+            size_t ch = sz - pos;
+            if (ch > (size_t) (f->wend_tag - f->end_tag)) {
+                ch = (size_t) (f->wend_tag - f->end_tag);
+            }
+            memcpy(&f->buf[f->end_tag - f->tag], &buf[pos], ch);
+            f->pos_tag += ch;
+            f->end_tag += ch;
+            pos += ch;
+            continue;
+        }
+        if (f->z) {
+            if (io61_zend_frame(f, false) < 0) {
+                return pos ? (ssize_t) pos : -1;
             }
+            continue;
+        }
+        io61_release(f);
+        if (f->cache->ndirty == 0 && !f->odirect && f->mode == O_WRONLY
+            && !io61_shared(f) && sz - pos >= io61_direct_min) {
+            ++f->stats.misses;
+            iovec iov = {(void*) &buf[pos], sz - pos};
+            size_t n = io61_write_at(f, &iov, 1, f->pos_tag);
+            io61_invalidate(f, f->pos_tag, f->pos_tag + n);
+            io61_set_window(f, nullptr, f->pos_tag + n);
+            pos += n;
+            if (pos < sz) {
+                return pos ? (ssize_t) pos : -1;
+            }
+            break;
+        }
+        if (io61_open_window(f) < 0) {
+            return pos ? (ssize_t) pos : -1;
+        }
+    }
+    return pos;
+}
+
+// io61_readv(f, iov, iovcnt), io61_writev(f, iov, iovcnt)
+//    Read into, or write from, the `iovcnt` buffers in `iov` in order,
+//    returning as io61_read or io61_write would for their concatenation.
+//    Large requests that would bypass the cache are made with one
+//    vectored system call, so callers with several fragments (such as a
+//    header and a payload) need not copy them together first.
+
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt) {
+    io61_check_invariants(f);
+    size_t total = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    if (iovcnt <= IOV_MAX && io61_read_direct(f, total)) {
+        ++f->stats.misses;
+        std::vector<iovec> v(iov, iov + iovcnt);
+        ssize_t n = io61_read_at(f, v.data(), iovcnt, f->pos_tag);
+        if (n > 0) {
+            io61_set_window(f, nullptr, f->pos_tag + n);
+        }
+        return n;
+    }
+    size_t pos = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_read(f, (unsigned char*) iov[i].iov_base,
+                              iov[i].iov_len);
+        if (n < 0) {
+            return pos ? (ssize_t) pos : -1;
+        }
+        pos += n;
+        if ((size_t) n != iov[i].iov_len) {
+            break;
         }
+    }
+    return pos;
+}
 
-        size_t ch = sz - pos;
-        if (ch > (size_t) (f->bufsize + f->tag - f->pos_tag)){
-            ch = (size_t) (f->bufsize + f->tag - f->pos_tag);
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt) {
+    io61_check_invariants(f);
+    size_t total = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    if (iovcnt <= IOV_MAX && total >= io61_direct_min
+        && !f->odirect && !f->z && f->mode == O_WRONLY
+        && !io61_shared(f)) {
+        io61_release(f);
+        if (f->cache->ndirty == 0) {
+            ++f->stats.misses;
+            std::vector<iovec> v(iov, iov + iovcnt);
+            size_t n = io61_write_at(f, v.data(), iovcnt, f->pos_tag);
+            io61_invalidate(f, f->pos_tag, f->pos_tag + n);
+            io61_set_window(f, nullptr, f->pos_tag + n);
+            return n ? (ssize_t) n : -1;
+        }
+    }
+    size_t pos = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const unsigned char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (n < 0) {
+            return pos ? (ssize_t) pos : -1;
+        }
+        pos += n;
+        if ((size_t) n != iov[i].iov_len) {
+            break;
         }
-        memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[pos], ch);
-        f->pos_tag += ch;
-        f->end_tag += ch;
-        pos += ch;
     }
     return pos;
 }
@@ -221,66 +2829,379 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    If `f` was opened read-only, `io61_flush(f)` returns 0. If may also
 //    drop any data cached for reading.
 
-
 int io61_flush(io61_file* f) {
-    // Check invariants.
-    if (!(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag) ||
-       (f->end_tag - f->pos_tag > f->bufsize)) {
-        return -1;
+    io61_check_invariants(f);
+    if (f->z) {
+        return io61_zflush(f);
+    } else if (f->mode == O_RDONLY) {
+        return 0;
     }
-    // Write cache invariant.
-    if (f->pos_tag != f->end_tag) {
+    io61_release(f);
+    if (io61_flush_dirty(f) < 0) {
         return -1;
     }
-
-    ssize_t n = write(f->fd, f->cbuf, f->pos_tag - f->tag);
-    if (n < 0) {
-        return -1;
+    // leave the file offset at the io61 position, as if every write had
+    // been sequential
+    if (f->seekable && f->fd_pos != f->pos_tag
+        && lseek(f->fd, f->pos_tag, SEEK_SET) != (off_t) -1) {
+        f->fd_pos = f->pos_tag;
     }
-    f->tag = f->pos_tag;
     return 0;
 }
 
 // io61_seek(f, pos)
 //    Changes the file pointer for file `f` to `pos` bytes into the file.
-//    Returns 0 on success and -1 on failure.
- 
-int io61_seek(io61_file* f, off_t pos) {
+//    Returns 0 on success and -1 on failure. A seek counts as a hit if
+//    the next read or write at `pos` can use cached data or the current
+//    write slot.
 
-    if (pos <= f->end_tag && pos >= f->tag) {
+int io61_seek(io61_file* f, off_t pos) {
+    io61_check_invariants(f);
+    f->line_held = false;
+    if (f->z) {
+        return io61_zseek(f, pos);
+    } else if (f->mapped) {
+        ++f->stats.seek_hits;
+        return io61_map_seek(f, pos);
+    }
+    if (pos == f->pos_tag
+        || (!f->wend_tag && pos >= f->tag && pos <= f->end_tag)) {
+        ++f->stats.seek_hits;
         f->pos_tag = pos;
         return 0;
     }
+    if (!f->seekable || pos < 0) {
+        errno = f->seekable ? EINVAL : ESPIPE;
+        return -1;
+    }
+    io61_slot* s = f->wend_tag ? f->cur : nullptr;
+    io61_release(f);
+    // Writing backwards (as in wreverse61), or in strides? If the next
+    // byte lands in the current slot, keep the window on that slot, so
+    // the write takes writec's fast path.
+    if (s
+        && pos >= s->off && pos < s->off + f->bufsize
+        && (f->mode != O_RDWR || pos <= s->off + s->len)) {
+        ++f->stats.seek_hits;
+        io61_set_window(f, s, pos, true);
+    } else {
+        ++(io61_find(f, pos - pos % f->bufsize) ? f->stats.seek_hits
+           : f->stats.seek_misses);
+        io61_set_window(f, nullptr, pos);
+    }
+    return 0;
+}
 
-    if (f->mode == O_RDONLY){
-        off_t r = (off_t) pos - (pos % f->bufsize);
-        off_t new_seek = lseek(f->fd, r, SEEK_SET);
-        if (new_seek == r) {
-            if (io61_fill(f) < 0) {
-                return -1;
+// io61_splice_relay(inf, outf, pout, n)
+//    Splices up to `n` bytes from `inf` to regular file `outf` at offset
+//    `*pout` through a pipe, since `splice` needs a pipe at one end.
+//    Returns as `splice` does.
+
+static ssize_t io61_splice_relay(io61_file* inf, io61_file* outf,
+                                 loff_t* pout, size_t n) {
+    if (inf->relay[0] < 0 && pipe2(inf->relay, O_CLOEXEC) < 0) {
+        errno = EINVAL;     // fall back to copying through the cache
+        return -1;
+    }
+    ssize_t k = splice(inf->fd, nullptr, inf->relay[1], nullptr, n,
+                       SPLICE_F_MOVE);
+    for (ssize_t pos = 0; k > 0 && pos != k; ) {
+        ssize_t m = splice(inf->relay[0], nullptr, outf->fd, pout, k - pos,
+                           SPLICE_F_MOVE);
+        if (m > 0) {
+            pos += m;
+        } else if (m == 0 || errno != EINTR) {
+            // the rest is stuck in the pipe: drop it, as a failed
+            // write would
+            if (m == 0) {
+                errno = EIO;
             }
-            f->pos_tag = pos;
-            f->tag = new_seek;
-            f->end_tag = new_seek + f->bufsize;
-            return 0;
+            int err = errno;
+            close(inf->relay[0]);
+            close(inf->relay[1]);
+            inf->relay[0] = inf->relay[1] = -1;
+            errno = err;
+            return -1;
         }
     }
+    return k;
+}
 
-    if (f->mode == O_WRONLY) {
-        if (io61_flush(f) < 0) {
-            return -1;
+// io61_copy_kernel(inf, outf, n)
+//    Copies up to `n` bytes from `inf` to `outf` without passing them
+//    through user space: `copy_file_range` between regular files,
+//    `sendfile` from a regular file to anything else, and `splice` from
+//    a pipe or socket. Uses explicit file offsets where it can. `inf`'s cache must
+//    hold no data past `pos_tag` that the kernel no longer has (pipes),
+//    and `outf` must be flushed. Returns the number of bytes copied, 0 at
+//    end of file, -1 on error, or -2 if no system call supports this
+//    pair of files. The copy counts as one system call of `inf`'s.
+
+static ssize_t io61_copy_kernel(io61_file* inf, io61_file* outf, size_t n) {
+    loff_t in_off = inf->pos_tag, out_off = outf->pos_tag;
+    loff_t* pin = inf->seekable ? &in_off : nullptr;
+    loff_t* pout = outf->seekable ? &out_off : nullptr;
+    if (inf->mapped) {
+        // don't run past the mapping
+        n = std::min(n, (size_t) (inf->end_tag - inf->pos_tag));
+    }
+    n = std::min(n, (size_t) SSIZE_MAX);
+    bool out_at_fd_pos = !pout;
+    ssize_t k;
+    double start = bench61_now();
+    while (true) {
+        k = -1;
+        errno = EINVAL;
+        if (inf->regular && outf->regular) {
+            k = copy_file_range(inf->fd, pin, outf->fd, pout, n, 0);
+        }
+        if (k < 0 && errno != EINTR && errno != EAGAIN && inf->regular
+            && (!outf->seekable || outf->fd_pos == outf->pos_tag)) {
+            k = sendfile(outf->fd, inf->fd, &in_off, n);
+            out_at_fd_pos = true;
         }
-        off_t new_seek = lseek(f->fd, pos, SEEK_SET);
-        if (new_seek == pos) {
-            f->tag = (off_t) pos - (pos % f->bufsize);
-            f->pos_tag = pos;
-            f->end_tag = new_seek + (new_seek % f->bufsize);
+        if (k < 0 && errno != EINTR && errno != EAGAIN && !inf->seekable) {
+            k = splice(inf->fd, nullptr, outf->fd, pout, n, SPLICE_F_MOVE);
+            out_at_fd_pos = !pout;
+            if (k < 0 && errno == EINVAL && outf->regular) {
+                k = io61_splice_relay(inf, outf, pout, n);
+            }
+        }
+        if (k >= 0 || errno != EINTR) {
+            break;
+        }
+    }
+    if (k < 0) {
+        if (errno == EINVAL || errno == ENOSYS || errno == EXDEV
+            || errno == EOPNOTSUPP || errno == ESPIPE) {
+            return -2;
+        }
+        io61_count(&inf->stats, k, start);
+        return -1;
+    }
+    io61_count(&inf->stats, k, start);
+    if (!inf->seekable) {
+        inf->fd_pos += k;
+    }
+    if (inf->mapped) {
+        inf->pos_tag += k;
+    } else {
+        io61_set_window(inf, nullptr, inf->pos_tag + k);
+    }
+    if (out_at_fd_pos) {
+        outf->fd_pos += k;
+    }
+    io61_invalidate(outf, outf->pos_tag, outf->pos_tag + k);
+    io61_set_window(outf, nullptr, outf->pos_tag + k);
+    return k;
+}
+
+// io61_copy_cached(inf, outf, n)
+//    Copies up to `n` bytes from `inf`'s cache window, filling it if
+//    necessary, to `outf` with io61_write. Returns as io61_copy_kernel
+//    does, except never -2.
+
+static ssize_t io61_copy_cached(io61_file* inf, io61_file* outf, size_t n) {
+    if (inf->pos_tag == inf->end_tag) {
+        if (io61_fill(inf) < 0) {
+            return -1;
+        } else if (inf->pos_tag == inf->end_tag) {
             return 0;
         }
     }
-    return -1;
+    size_t ch = std::min(n, (size_t) (inf->end_tag - inf->pos_tag));
+    ssize_t w = io61_write(outf, &inf->buf[inf->pos_tag - inf->tag], ch);
+    if (w > 0) {
+        inf->pos_tag += w;
+    }
+    return w;
+}
+
+// io61_copy(inf, outf, n)
+//    Copies up to `n` bytes from read file `inf` to write file `outf`,
+//    stopping early only at end of file or on error. Returns the number
+//    of bytes copied, or 0 at end of file or -1 on error if nothing was
+//    copied.
+//
+//    Data moves in the kernel when the file types allow it (see
+//    io61_copy_kernel), and otherwise through `inf`'s cache. Bytes
+//    already read from a pipe into `inf`'s cache are copied first. The
+//    kernel copies go through the page cache, so O_DIRECT files skip
+//    them, as do read/write files and files sharing a cache, whose
+//    caches the kernel would bypass. Simulated storage (io61_faults)
+//    turns them off.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t n) {
+    assert(inf->mode != O_WRONLY && outf->mode != O_RDONLY);
+    io61_check_invariants(inf);
+    io61_check_invariants(outf);
+    io61_wait(inf);
+
+    size_t pos = 0;
+    while (pos < n) {
+        ssize_t k = -2;
+        bool cached = !inf->seekable
+            && (inf->pos_tag < inf->end_tag || io61_find(inf, inf->pos_tag));
+        if (!cached && inf->nocopy_fd != outf->fd
+            && inf->mode == O_RDONLY && outf->mode == O_WRONLY
+            && !inf->odirect && !outf->odirect
+            && !io61_shared(inf) && !io61_shared(outf)
+            && !inf->z && !outf->z && !io61_get_faults()) {
+            k = io61_flush(outf) < 0 ? -1 : io61_copy_kernel(inf, outf, n - pos);
+            if (k == -2) {
+                inf->nocopy_fd = outf->fd;
+            }
+        }
+        if (k == -2) {
+            k = io61_copy_cached(inf, outf, n - pos);
+        }
+        if (k <= 0) {
+            return pos ? (ssize_t) pos : k;
+        }
+        pos += k;
+    }
+    return pos;
+}
+
+
+// io61_poller
+//    A set of io61 files waited on together with epoll. A file is ready
+//    when an io61 call on it can make progress without blocking: a read
+//    file has cached bytes or a readable fd, and a write file has room in
+//    its window, nothing left to write, or a writable fd. Files epoll
+//    can't watch, such as regular files, are always ready.
+
+struct io61_poller {
+    int epfd;
+    std::vector<std::pair<io61_file*, bool>> files;   // file, watched?
+};
+
+
+// io61_poller_new()
+//    Returns a new, empty io61_poller, or nullptr on error.
+
+io61_poller* io61_poller_new() {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        return nullptr;
+    }
+    io61_poller* p = new io61_poller;
+    p->epfd = epfd;
+    return p;
+}
+
+
+// io61_poller_add(p, f)
+//    Adds `f` to `p`. Returns 0 on success and -1 on error.
+
+int io61_poller_add(io61_poller* p, io61_file* f) {
+    epoll_event ev;
+    ev.events = f->mode == O_WRONLY ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = f;
+    bool watched = epoll_ctl(p->epfd, EPOLL_CTL_ADD, f->fd, &ev) == 0;
+    if (!watched && errno != EPERM) {
+        return -1;
+    }
+    p->files.emplace_back(f, watched);
+    return 0;
+}
+
+
+// io61_poller_remove(p, f)
+//    Removes `f` from `p`. Files must be removed before they are closed.
+
+void io61_poller_remove(io61_poller* p, io61_file* f) {
+    for (auto it = p->files.begin(); it != p->files.end(); ++it) {
+        if (it->first == f) {
+            if (it->second) {
+                epoll_ctl(p->epfd, EPOLL_CTL_DEL, f->fd, nullptr);
+            }
+            p->files.erase(it);
+            return;
+        }
+    }
+}
+
+
+// io61_poller_free(p)
+//    Frees `p`. Its files stay open.
+
+void io61_poller_free(io61_poller* p) {
+    close(p->epfd);
+    delete p;
+}
+
+
+// io61_cache_ready(f)
+//    Returns true if the next io61 call on `f` can proceed without
+//    asking the kernel whether its fd is ready.
+
+static bool io61_cache_ready(io61_file* f) {
+    if (f->z) {
+        return (f->mode == O_WRONLY ? f->end_tag < f->wend_tag
+                : f->pos_tag < f->end_tag)
+            || io61_cache_ready(f->z->inner);
+    } else if (f->mapped || f->regular) {
+        return true;
+    } else if (f->mode == O_WRONLY) {
+        return f->end_tag < f->wend_tag
+            || (f->cache->ndirty == 0
+                && (!f->wend_tag || f->wstart == f->end_tag));
+    } else if (f->pos_tag < f->end_tag) {
+        return true;
+    }
+    io61_slot* s = io61_find(f, f->seekable
+                                ? f->pos_tag - f->pos_tag % f->bufsize
+                                : f->pos_tag);
+    return s && !s->busy && f->pos_tag < s->off + s->len;
+}
+
+
+// io61_poll(p, ready, n, timeout)
+//    Waits until at least one file in `p` is ready, or `timeout`
+//    milliseconds pass (`timeout < 0` waits forever). Stores up to `n`
+//    ready files in `ready` and returns how many it stored, or -1 on
+//    error (for instance, EINTR). Files ready from their caches are
+//    reported without waiting.
+
+int io61_poll(io61_poller* p, io61_file** ready, int n, int timeout) {
+    int nready = 0;
+    for (auto& fw : p->files) {
+        if (nready != n && (!fw.second || io61_cache_ready(fw.first))) {
+            ready[nready] = fw.first;
+            ++nready;
+        }
+    }
+    if (nready == n) {
+        return nready;
+    }
+
+    epoll_event evs[64];
+    int nev = epoll_wait(p->epfd, evs, std::min(n - nready, 64),
+                         nready ? 0 : timeout);
+    if (nev < 0) {
+        return nready ? nready : -1;
+    }
+    for (int i = 0; i != nev; ++i) {
+        auto f = (io61_file*) evs[i].data.ptr;
+        if (!io61_cache_ready(f)) {     // otherwise, already stored
+            ready[nready] = f;
+            ++nready;
+        }
+    }
+    return nready;
+}
+
+
+// io61_stats(f)
+//    Returns the statistics io61 has collected for `f`. In async mode,
+//    they omit an operation still in flight.
+
+io61_statistics io61_stats(io61_file* f) {
+    return f->z ? io61_stats(f->z->inner) : f->stats;
 }
 
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -302,7 +3223,13 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    io61_file* f = io61_fdopen(fd, mode & O_ACCMODE);
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", filename ? filename : "io61",
+                strerror(errno));
+        exit(1);
+    }
+    return f;
 }
 
 
@@ -319,6 +3246,9 @@ int io61_fileno(io61_file* f) {
 //    well-defined size (for instance, if it is a pipe).
 
 off_t io61_filesize(io61_file* f) {
+    if (f->z) {
+        return io61_zfilesize(f);
+    }
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode)) {
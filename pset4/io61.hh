@@ -9,6 +9,24 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <sys/uio.h>
+
+// io61_window
+//    The cache window that the inline io61_readc and io61_writec use.
+//    Every io61_file derives from it first. If `pos_tag < end_tag`,
+//    the next byte to read is `buf[pos_tag - tag]`; if
+//    `end_tag < wend_tag`, the next byte written goes to
+//    `buf[end_tag - tag]`. Otherwise they call io61_readc_slow or
+//    io61_writec_slow to refill or flush the window. A library with no
+//    cache leaves the window empty.
+
+struct io61_window {
+    unsigned char* buf = nullptr;
+    off_t tag = 0;          // file offset of `buf[0]`
+    off_t end_tag = 0;      // file offset one past last valid byte
+    off_t pos_tag = 0;      // file position
+    off_t wend_tag = 0;     // writes may extend `end_tag` up to here
+};
 
 struct io61_file;
 
@@ -21,14 +39,77 @@ off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t pos);
 
-int io61_readc(io61_file* f);
-int io61_writec(io61_file* f, int ch);
+int io61_readc_slow(io61_file* f);
+int io61_writec_slow(io61_file* f, int ch);
+
+// io61_readc(f), io61_writec(f, ch)
+//    Read or write a single byte. The common case, a byte in the window,
+//    is a compare and a load or store.
+
+inline int io61_readc(io61_file* f) {
+    auto w = reinterpret_cast<io61_window*>(f);
+    if (w->pos_tag < w->end_tag) {
+        return w->buf[w->pos_tag++ - w->tag];
+    }
+    return io61_readc_slow(f);
+}
+
+inline int io61_writec(io61_file* f, int ch) {
+    auto w = reinterpret_cast<io61_window*>(f);
+    if (w->end_tag < w->wend_tag) {
+        w->buf[w->end_tag - w->tag] = ch;
+        ++w->pos_tag;
+        ++w->end_tag;
+        return 0;
+    }
+    return io61_writec_slow(f, ch);
+}
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz);
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt);
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz);
+int io61_peekline(io61_file* f, const unsigned char** ptr, size_t* len);
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t n);
 
 int io61_flush(io61_file* f);
 
+// io61_statistics
+//    Counters that io61 keeps for each file (io61_stats). At exit, io61
+//    reports every file's counters, and their totals, as JSON lines on
+//    the bench61 channel (file descriptor 100 or $BENCH61).
+
+struct io61_statistics {
+    unsigned long long syscalls = 0;    // data system calls (read, write,
+    unsigned long long bytes = 0;       //   copy...) and bytes they moved
+    unsigned long long hist[24] = {};   // calls by bytes moved: `hist[k]`
+                                        //   counts `2^(k-1) <= n < 2^k`
+                                        //   (`hist[0]`: none or error)
+    unsigned long long hits = 0;        // cache lookups for a read or
+    unsigned long long misses = 0;      //   write that found the slot
+    unsigned long long seek_hits = 0;   // seeks to cached positions
+    unsigned long long seek_misses = 0;
+    double blocked = 0;                 // seconds waiting for data calls
+};
+
+io61_statistics io61_stats(io61_file* f);
+
+// io61_poller
+//    Waits for any of several io61 files to be ready, so one thread can
+//    pump many nonblocking files (see io61_poll). On a nonblocking file,
+//    io61 calls that would block return -1 (or a short count) with
+//    `errno == EAGAIN`.
+
+struct io61_poller;
+io61_poller* io61_poller_new();
+int io61_poller_add(io61_poller* p, io61_file* f);
+void io61_poller_remove(io61_poller* p, io61_file* f);
+void io61_poller_free(io61_poller* p);
+int io61_poll(io61_poller* p, io61_file** ready, int n, int timeout);
+
 int fd_open_check(const char* filename, int mode);
 FILE* stdio_open_check(const char* filename, int mode);
 
@@ -40,6 +121,7 @@ struct io61_args {
     size_t stride = 1024;               // `-t`: stride
     bool lines = false;                 // `-l`: read by lines
     bool flush = false;                 // `-F`: flush output
+    bool copy = false;                  // `-c`: copy with io61_copy
     bool quiet = false;                 // `-q`: ignore errors
     unsigned yield = 0;                 // `-y`: yield after output
     const char* output_file = nullptr;  // `-o`: output file
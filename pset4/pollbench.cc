@@ -0,0 +1,271 @@
+#include "io61.hh"
+#include "bench61.hh"
+#include <cerrno>
+#include <csignal>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+// Usage: ./pollbench [-n STREAMS] [-s SIZE] [-S SLOWSIZE] [-b BURST]
+//                    [-D DELAY] [-B SOCKBUF] [-t TRIALS] [-w WARMUP]
+//                    [MODE...]
+//    Times one process reading many socket streams, as scattergather61
+//    reads many inputs, and prints one bench61 JSON record per mode (to
+//    file descriptor 100 or $BENCH61 if available, otherwise to standard
+//    output). Each of the STREAMS (default 8) is a loopback TCP
+//    connection, set up as in socketpipe, from a child writer. The first
+//    stream is slow: it writes SLOWSIZE bytes (default 256 KiB) in
+//    BURST-byte bursts (default 4 KiB), sleeping DELAY seconds (default
+//    0.002) after each. The others write SIZE bytes (default 1 MiB) as
+//    fast as they are read. SOCKBUF (default 16384) sets the socket
+//    buffer sizes, so a stream that isn't read soon stalls its writer.
+//
+//    Modes are `roundrobin`, which reads one 4 KiB block from each
+//    stream in turn with blocking io61_read, and `poll`, which makes the
+//    streams nonblocking and reads whichever io61_poll reports ready. The
+//    default is both.
+
+
+static size_t nstreams = 8;
+static size_t stream_size = 1 << 20;
+static size_t slow_size = 256 << 10;
+static size_t burst = 4 << 10;
+static double delay = 0.002;
+static int sockbuf = 16384;
+
+
+// make_stream(fds)
+//    Connects a loopback TCP socket pair; `fds[0]` reads, `fds[1]` writes.
+
+static void make_stream(int fds[2]) {
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(sfd >= 0);
+    sockaddr_in addr_in;
+    memset(&addr_in, 0, sizeof(addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr_in);
+    int r = bind(sfd, (const sockaddr*) &addr_in, addrlen);
+    assert(r == 0);
+    r = listen(sfd, 1);
+    assert(r == 0);
+    r = getsockname(sfd, (sockaddr*) &addr_in, &addrlen);
+    assert(r == 0);
+
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fds[0] >= 0);
+    r = setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof(sockbuf));
+    assert(r == 0);
+    r = connect(fds[0], (const sockaddr*) &addr_in, addrlen);
+    assert(r == 0);
+    fds[1] = accept(sfd, nullptr, nullptr);
+    assert(fds[1] >= 0);
+    r = setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(sockbuf));
+    assert(r == 0);
+    close(sfd);
+}
+
+
+// size_of(i)
+//    Returns the number of bytes written to stream `i`.
+
+static size_t size_of(size_t i) {
+    return i == 0 ? slow_size : stream_size;
+}
+
+
+// produce(fd, i)
+//    The writer for stream `i`: writes `size_of(i)` bytes, `(i + k) % 251`
+//    for the `k`th byte.
+
+[[noreturn]] static void produce(int fd, size_t i) {
+    size_t chunk = i == 0 ? burst : 64 << 10;
+    std::vector<unsigned char> buf(chunk);
+    for (size_t pos = 0; pos < size_of(i); ) {
+        size_t n = std::min(chunk, size_of(i) - pos);
+        for (size_t k = 0; k != n; ++k) {
+            buf[k] = (i + pos + k) % 251;
+        }
+        for (size_t w = 0; w != n; ) {
+            ssize_t nw = write(fd, &buf[w], n - w);
+            assert(nw > 0);
+            w += nw;
+        }
+        pos += n;
+        if (i == 0) {
+            usleep((useconds_t) (delay * 1e6));
+        }
+    }
+    _exit(0);
+}
+
+
+// struct stream
+//    The reader's view of one stream.
+
+struct stream {
+    io61_file* f;
+    size_t i;
+    size_t pos = 0;
+};
+
+
+// consume(s, buf, n)
+//    Checks the `n` bytes in `buf` just read from `s`.
+
+static void consume(stream& s, const unsigned char* buf, size_t n) {
+    for (size_t k = 0; k != n; ++k) {
+        assert(buf[k] == (s.i + s.pos + k) % 251);
+    }
+    s.pos += n;
+}
+
+
+// run_trial(use_poll)
+//    Starts the writers, reads every stream to end of file, and reaps
+//    the writers.
+
+static void run_trial(bool use_poll) {
+    std::vector<stream> streams;
+    std::vector<pid_t> pids;
+    for (size_t i = 0; i != nstreams; ++i) {
+        int fds[2];
+        make_stream(fds);
+        pid_t p = fork();
+        assert(p >= 0);
+        if (p == 0) {
+            close(fds[0]);
+            for (auto& s : streams) {
+                close(io61_fileno(s.f));
+            }
+            produce(fds[1], i);
+        }
+        close(fds[1]);
+        pids.push_back(p);
+        streams.push_back({io61_fdopen(fds[0], O_RDONLY), i});
+    }
+
+    unsigned char buf[4096];
+    if (!use_poll) {
+        // read one block from each open stream in turn
+        size_t nopen = streams.size();
+        while (nopen != 0) {
+            for (auto& s : streams) {
+                if (!s.f) {
+                    continue;
+                }
+                ssize_t nr = io61_read(s.f, buf, sizeof(buf));
+                assert(nr >= 0);
+                if (nr == 0) {
+                    io61_close(s.f);
+                    s.f = nullptr;
+                    --nopen;
+                } else {
+                    consume(s, buf, nr);
+                }
+            }
+        }
+    } else {
+        io61_poller* p = io61_poller_new();
+        assert(p);
+        for (auto& s : streams) {
+            int fd = io61_fileno(s.f);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int r = io61_poller_add(p, s.f);
+            assert(r == 0);
+        }
+        size_t nopen = streams.size();
+        std::vector<io61_file*> ready(nopen);
+        while (nopen != 0) {
+            int nready = io61_poll(p, ready.data(), ready.size(), -1);
+            assert(nready >= 0 || errno == EINTR);
+            for (int j = 0; j < nready; ++j) {
+                stream* s = nullptr;
+                for (auto& st : streams) {
+                    if (st.f == ready[j]) {
+                        s = &st;
+                    }
+                }
+                // drain what is there
+                ssize_t nr;
+                while ((nr = io61_read(s->f, buf, sizeof(buf))) > 0) {
+                    consume(*s, buf, nr);
+                }
+                assert(nr == 0 || errno == EAGAIN);
+                if (nr == 0) {
+                    io61_poller_remove(p, s->f);
+                    io61_close(s->f);
+                    s->f = nullptr;
+                    --nopen;
+                }
+            }
+        }
+        io61_poller_free(p);
+    }
+
+    for (auto& s : streams) {
+        assert(s.pos == size_of(s.i));
+    }
+    for (auto p : pids) {
+        int status;
+        waitpid(p, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    unsigned trials = 5, warmup = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:S:b:D:B:t:w:")) != -1) {
+        if (opt == 'n') {
+            nstreams = strtoul(optarg, nullptr, 0);
+        } else if (opt == 's') {
+            stream_size = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'S') {
+            slow_size = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'b') {
+            burst = std::max(strtoul(optarg, nullptr, 0), 1UL);
+        } else if (opt == 'D') {
+            delay = strtod(optarg, nullptr);
+        } else if (opt == 'B') {
+            sockbuf = (int) strtol(optarg, nullptr, 0);
+        } else if (opt == 't') {
+            trials = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'w') {
+            warmup = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: %s [-n STREAMS] [-s SIZE] [-S SLOWSIZE] [-b BURST] [-D DELAY] [-B SOCKBUF] [-t TRIALS] [-w WARMUP] [MODE...]\n", argv[0]);
+            exit(1);
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct mode {
+        const char* name;
+        bool use_poll;
+    } modes[] = {
+        {"roundrobin", false}, {"poll", true}
+    };
+
+    int fd = bench61_output_fd();
+    if (fd < 0) {
+        fd = STDOUT_FILENO;
+    }
+    for (auto& m : modes) {
+        bool selected = optind == argc;
+        for (int i = optind; i < argc; ++i) {
+            selected = selected || strcmp(argv[i], m.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        bench61_record rec = bench61_run(m.name, [&] {
+            run_trial(m.use_poll);
+        }, trials, warmup);
+        rec.add("streams", nstreams);
+        rec.add("bytes", slow_size + (nstreams - 1) * stream_size);
+        rec.emit(fd);
+    }
+}
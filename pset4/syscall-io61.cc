@@ -3,6 +3,8 @@
 #include <sys/stat.h>
 #include <climits>
 #include <cerrno>
+#include <algorithm>
+#include <poll.h>
 
 // syscall-io61.cc
 //    This version of io61.cc makes one system call per read/write.
@@ -11,21 +13,23 @@
 // io61_file
 //    Data structure for io61 file wrappers.
 
-struct io61_file {
+struct io61_file : io61_window {
     int fd = -1;     // file descriptor
+    int mode;
+    std::vector<unsigned char> line;    // io61_peekline's line
 };
 
 
 // io61_fdopen(fd, mode)
-//    Returns a new io61_file for file descriptor `fd`. `mode` is either
-//    O_RDONLY for a read-only file or O_WRONLY for a write-only file.
-//    You need not support read/write files.
+//    Returns a new io61_file for file descriptor `fd`. `mode` is
+//    O_RDONLY for a read-only file, O_WRONLY for a write-only file, or
+//    O_RDWR for a read/write file.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
-    (void) mode;
+    f->mode = mode & O_ACCMODE;
     return f;
 }
 
@@ -41,11 +45,12 @@ int io61_close(io61_file* f) {
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
-//    which equals -1, on end of file or error.
+//    which equals -1, on end of file or error. This library keeps no
+//    io61_window, so every io61_readc call lands here.
 
-int io61_readc(io61_file* f) {
+int io61_readc_slow(io61_file* f) {
     unsigned char buf[1];
     ssize_t nr = read(f->fd, buf, 1);
     if (nr == 1) {
@@ -75,11 +80,11 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 }
 
 
-// io61_writec(f)
+// io61_writec_slow(f, ch)
 //    Write a single character `ch` to `f`. Returns 0 on success and
-//    -1 on error.
+//    -1 on error. Every io61_writec call lands here.
 
-int io61_writec(io61_file* f, int ch) {
+int io61_writec_slow(io61_file* f, int ch) {
     unsigned char buf[1];
     buf[0] = ch;
     ssize_t nw = write(f->fd, buf, 1);
@@ -103,6 +108,90 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 }
 
 
+// io61_copy(inf, outf, n)
+//    Copies up to `n` bytes from `inf` to `outf`, stopping early only at
+//    end of file or on error. Returns the number of bytes copied, or 0 at
+//    end of file or -1 on error if nothing was copied.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t n) {
+    unsigned char buf[8192];
+    size_t pos = 0;
+    while (pos < n) {
+        size_t want = n - pos < sizeof(buf) ? n - pos : sizeof(buf);
+        ssize_t nr = io61_read(inf, buf, want);
+        if (nr <= 0) {
+            return pos ? (ssize_t) pos : nr;
+        }
+        ssize_t nw = io61_write(outf, buf, nr);
+        if (nw > 0) {
+            pos += nw;
+        }
+        if (nw != nr) {
+            return pos ? (ssize_t) pos : -1;
+        }
+    }
+    return pos;
+}
+
+
+// io61_readv(f, iov, iovcnt), io61_writev(f, iov, iovcnt)
+//    Read into, or write from, the `iovcnt` buffers in `iov` in order,
+//    returning as io61_read or io61_write would for their concatenation.
+
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt) {
+    return readv(f->fd, iov, iovcnt);
+}
+
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt) {
+    return writev(f->fd, iov, iovcnt);
+}
+
+
+// io61_readline(f, buf, sz)
+//    Reads bytes from `f` into `buf` up to and including the next
+//    newline, but at most `sz` bytes. Returns the number of bytes read,
+//    0 at end of file, or -1 on error before any bytes were read.
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz) {
+    size_t pos = 0;
+    while (pos != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            break;
+        }
+        buf[pos] = ch;
+        ++pos;
+        if (ch == '\n') {
+            break;
+        }
+    }
+    return pos;
+}
+
+
+// io61_peekline(f, ptr, len)
+//    Reads the next line of `f`, including its newline if any. On success
+//    sets `*ptr` and `*len` to the line, which stays valid until the next
+//    call on `f`, and returns 0. Returns EOF at end of file or on error.
+
+int io61_peekline(io61_file* f, const unsigned char** ptr, size_t* len) {
+    f->line.clear();
+    int ch;
+    while ((ch = io61_readc(f)) != EOF) {
+        f->line.push_back(ch);
+        if (ch == '\n') {
+            break;
+        }
+    }
+    if (f->line.empty()) {
+        return EOF;
+    }
+    *ptr = f->line.data();
+    *len = f->line.size();
+    return 0;
+}
+
+
 // io61_flush(f)
 //    Forces a write of any cached data written to `f`. Returns 0 on
 //    success. Returns -1 if an error is encountered before all cached
@@ -131,6 +220,74 @@ int io61_seek(io61_file* f, off_t pos) {
 }
 
 
+// io61_poller
+//    A set of io61 files waited on together with poll(2). This library keeps no
+//    read cache, so a file is ready when its fd is.
+
+struct io61_poller {
+    std::vector<io61_file*> files;
+};
+
+
+// io61_poller_new(), io61_poller_add(p, f), io61_poller_remove(p, f),
+// io61_poller_free(p)
+//    Create a poller, add a file to it, remove a file from it (before
+//    closing the file), and free it.
+
+io61_poller* io61_poller_new() {
+    return new io61_poller;
+}
+
+int io61_poller_add(io61_poller* p, io61_file* f) {
+    p->files.push_back(f);
+    return 0;
+}
+
+void io61_poller_remove(io61_poller* p, io61_file* f) {
+    p->files.erase(std::remove(p->files.begin(), p->files.end(), f),
+                   p->files.end());
+}
+
+void io61_poller_free(io61_poller* p) {
+    delete p;
+}
+
+
+// io61_poll(p, ready, n, timeout)
+//    Waits until at least one file in `p` is ready, or `timeout`
+//    milliseconds pass. Stores up to `n` ready files in `ready` and
+//    returns how many it stored, or -1 on error.
+
+int io61_poll(io61_poller* p, io61_file** ready, int n, int timeout) {
+    std::vector<pollfd> pfds;
+    for (auto f : p->files) {
+        short events = f->mode == O_WRONLY ? POLLOUT : POLLIN;
+        pfds.push_back({f->fd, events, 0});
+    }
+    if (poll(pfds.data(), pfds.size(), timeout) < 0) {
+        return -1;
+    }
+    int nready = 0;
+    for (size_t i = 0; i != pfds.size() && nready != n; ++i) {
+        if (pfds[i].revents) {
+            ready[nready] = p->files[i];
+            ++nready;
+        }
+    }
+    return nready;
+}
+
+
+// io61_stats(f)
+//    Returns the statistics io61 has collected for `f`. This library keeps
+//    no statistics, so they are all zero.
+
+io61_statistics io61_stats(io61_file* f) {
+    (void) f;
+    return io61_statistics();
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -1,5 +1,4 @@
 #include "ftxdb.hh"
-#include <sys/resource.h>
 #include <thread>
 #include <mutex>
 
@@ -81,7 +80,7 @@ int main(int argc, char* argv[]) {
     ledgerf = io61_open_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
     args.after_open(ledgerf, O_WRONLY);
     std::random_device seed_randomness;
-    double start_time = monotonic_timestamp();
+    ftx_timer timer;
 
     // Run transfers
     std::vector<std::thread> th(args.nthreads);
@@ -102,13 +101,5 @@ int main(int argc, char* argv[]) {
     delete db;
     io61_close(ledgerf);
 
-    double end_time = monotonic_timestamp();
-    struct rusage usage;
-    int r = getrusage(RUSAGE_SELF, &usage);
-    assert(r == 0);
-    fprintf(stderr, "%d %s, %zu %s, %d.%06ds CPU time, %.6fs real time\n",
-            args.nthreads, args.nthreads == 1 ? "thread" : "threads",
-            totalops, totalops == 1 ? "operation" : "operations",
-            (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
-            end_time - start_time);
+    timer.report(args.nthreads, totalops);
 }
@@ -8,6 +8,19 @@
 struct ftx_acct;
 
 
+
+// ftx_timer
+//    Measures one run of an ftx tool. `report` prints the usual summary
+//    line to standard error and adds the thread and operation counts to
+//    the program's bench61 record.
+
+struct ftx_timer {
+    double start_time;
+
+    ftx_timer();
+    void report(int nthreads, size_t totalops);
+};
+
 // ftx_db
 //    Structure representing an open account database.
 
@@ -1,6 +1,7 @@
 #include "ftxdb.hh"
 #include <charconv>
 #include <cstdlib>
+#include <sys/resource.h>
 
 ftx_db::ftx_db(io61_file* f_) {
     this->f = f_;
@@ -107,3 +108,26 @@ std::pair<const char*, size_t> ftx_acct::unparse(char* buf, size_t len,
     *tcr.ptr++ = '\n';
     return std::make_pair(tcr.ptr - db.balance_size - 1, db.balance_size + 1);
 }
+
+
+ftx_timer::ftx_timer() {
+    this->start_time = monotonic_timestamp();
+}
+
+void ftx_timer::report(int nthreads, size_t totalops) {
+    double elapsed = monotonic_timestamp() - this->start_time;
+
+    struct rusage usage;
+    int r = getrusage(RUSAGE_SELF, &usage);
+    assert(r == 0);
+    fprintf(stderr, "%d %s, %zu %s, %d.%06ds CPU time, %.6fs real time\n",
+            nthreads, nthreads == 1 ? "thread" : "threads",
+            totalops, totalops == 1 ? "operation" : "operations",
+            (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
+            elapsed);
+
+    // The profiler in helpers.cc emits the run's bench61 record.
+    profile_add("threads", nthreads);
+    profile_add("operations", totalops);
+    profile_add("ops_per_sec", elapsed > 0 ? totalops / elapsed : 0);
+}
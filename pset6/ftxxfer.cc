@@ -1,5 +1,4 @@
 #include "ftxdb.hh"
-#include <sys/resource.h>
 #include <thread>
 #include <mutex>
 
@@ -63,7 +62,7 @@ int main(int argc, char* argv[]) {
     ftx_db* db = ftx_db::open_args(args);
     args.after_open(db->f, O_RDWR);
     std::random_device seed_randomness;
-    double start_time = monotonic_timestamp();
+    ftx_timer timer;
 
     // Run transfers
     std::vector<std::thread> th(args.nthreads);
@@ -83,13 +82,5 @@ int main(int argc, char* argv[]) {
     // Flush and close
     delete db;
 
-    double end_time = monotonic_timestamp();
-    struct rusage usage;
-    int r = getrusage(RUSAGE_SELF, &usage);
-    assert(r == 0);
-    fprintf(stderr, "%d %s, %zu %s, %d.%06ds CPU time, %.6fs real time\n",
-            args.nthreads, args.nthreads == 1 ? "thread" : "threads",
-            totalops, totalops == 1 ? "operation" : "operations",
-            (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
-            end_time - start_time);
+    timer.report(args.nthreads, totalops);
 }
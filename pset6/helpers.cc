@@ -1,4 +1,5 @@
 #include "io61.hh"
+#include "bench61.hh"
 #include <ctime>
 #include <csignal>
 #include <cerrno>
@@ -388,6 +389,9 @@ namespace {
 
 struct io61_profiler {
     double begin_at;
+    bench61_cycle_counter cycles;
+    uint64_t begin_cycles;
+    std::vector<std::pair<const char*, double>> extra;
     io61_profiler();
     ~io61_profiler();
 };
@@ -396,51 +400,40 @@ static io61_profiler profiler_instance;
 
 io61_profiler::io61_profiler() {
     this->begin_at = monotonic_timestamp();
+    this->begin_cycles = this->cycles.read();
 }
 
 io61_profiler::~io61_profiler() {
     // Measure elapsed real, user, and system times, and report the result
-    // as JSON to file descriptor 100 if it’s available.
+    // as a one-trial bench61 record to file descriptor 100 if it’s
+    // available.
 
-    double real_elapsed = monotonic_timestamp() - this->begin_at;
-
-    struct rusage usage;
-    int r = getrusage(RUSAGE_SELF, &usage);
-    assert(r == 0);
-
-    struct rusage cusage;
-    r = getrusage(RUSAGE_CHILDREN, &cusage);
-    assert(r == 0);
-    timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
-    timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
-
-    long maxrss = usage.ru_maxrss + cusage.ru_maxrss;
-#if __MACH__
-    maxrss = (maxrss + 1023) / 1024;
+#if __GLIBC__
+    bench61_record rec(program_invocation_short_name);
+#else
+    bench61_record rec(getprogname());
 #endif
+    rec.times.push_back(monotonic_timestamp() - this->begin_at);
+    rec.cycles.push_back(this->cycles.read() - this->begin_cycles);
+    rec.cycles_source = this->cycles.source;
+    for (auto& kv : this->extra) {
+        rec.add(kv.first, kv.second);
+    }
 
-    char buf[1000];
-    ssize_t len = snprintf(buf, sizeof(buf),
-        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
-        real_elapsed,
-        usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
-        usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-        maxrss);
-
-    off_t off = lseek(100, 0, SEEK_CUR);
-    int fd = (off != (off_t) -1 || errno == ESPIPE ? 100 : STDERR_FILENO);
-    if (fd == STDERR_FILENO && !getenv("TIMING")) {
-        return;
-    } else if (fd == STDERR_FILENO) {
-        fflush(stderr);
-    }
-    while (true) {
-        ssize_t nw = write(fd, buf, len);
-        if (nw == len) {
-            break;
-        }
-        assert(nw == -1 && (errno == EINTR || errno == EAGAIN));
+    int fd = bench61_output_fd();
+    if (fd < 0 && getenv("TIMING")) {
+        fd = STDERR_FILENO;
     }
+    rec.emit(fd);
+}
+
 }
 
+
+// profile_add(key, value)
+//    Adds a numeric field, such as an operation count, to the bench61
+//    record that the profiler emits at exit.
+
+void profile_add(const char* key, double value) {
+    profiler_instance.extra.emplace_back(key, value);
 }
@@ -41,6 +41,7 @@ int io61_flush(io61_file* f);
 int fd_open_check(const char* filename, int mode);
 FILE* stdio_open_check(const char* filename, int mode);
 double monotonic_timestamp();
+void profile_add(const char* key, double value);
 
 
 struct io61_args {